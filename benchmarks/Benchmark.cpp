@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ThreadSafe.h"
+#include "Measurements.h"
+
+//Benchmarks of the ThreadSafe wrapper against the equivalent hand-written locking. Each measurement is printed as a JSON object on its own line (see Measurements.h).
+//Options: --quick (fewer iterations, for smoke runs), --threads=N (the maximum number of threads of the contention benchmark).
+
+using namespace measurements;
+
+namespace {
+
+    struct Settings {
+        int batches = 200; //Latency samples of the single-thread benchmarks.
+        int batchSize = 10'000; //Operations per sample.
+        int contendedOps = 200'000; //Operations per thread of the contention benchmark.
+        unsigned maxThreads = 4;
+    };
+
+    //Runs op in batches of settings.batchSize calls, after a warm up, and returns the time per call of each batch.
+    template<typename Op>
+    std::vector<double> timeBatches(const Settings& settings, Op op) {
+        for (int i = 0; i < settings.batchSize; ++i) {
+            op();
+        }
+        std::vector<double> samples;
+        samples.reserve(settings.batches);
+        for (int b = 0; b < settings.batches; ++b) {
+            auto start = Clock::now();
+            for (int i = 0; i < settings.batchSize; ++i) {
+                op();
+            }
+            samples.push_back(nanosecondsSince(start) / settings.batchSize);
+        }
+        return samples;
+    }
+
+    template<typename Op>
+    void reportBatches(const Settings& settings, const char* benchmark, const std::string& variant, int width, Op op) {
+        std::vector<double> samples = timeBatches(settings, op);
+        Percentiles p = percentilesOf(samples);
+        JsonLine{}.field("benchmark", benchmark).field("variant", variant).field("width", width).field("ns_per_op", p.p50).latencies(p).print();
+    }
+
+    //Uncontended cost of a single access: a Temp object against a std::lock_guard on the same kind of lock.
+    template<typename LockPolicy>
+    void uncontended(const Settings& settings, const std::string& lockName) {
+        LockPolicy raw;
+        long rawValue = 0;
+        thread_safe::ThreadSafe<long, LockPolicy> wrapped{0L};
+
+        reportBatches(settings, "uncontended", "std::lock_guard<" + lockName + ">", 1, [&]() {
+            std::lock_guard lock{raw};
+            ++rawValue;
+        });
+        reportBatches(settings, "uncontended", "Temp<" + lockName + ">", 1, [&]() {
+            ++*wrapped;
+        });
+        reportBatches(settings, "uncontended", "lock()<" + lockName + ">", 1, [&]() {
+            auto guard = wrapped.lock();
+            ++*guard;
+        });
+    }
+
+    //A comma separated list of Width objects against a std::scoped_lock of Width mutexes.
+    template<std::size_t Width>
+    void lockList(const Settings& settings) {
+        std::array<thread_safe::ThreadSafe<long, std::mutex>, Width> objects{};
+        std::array<std::mutex, Width> mutexes;
+        long rawValue = 0;
+
+        [&]<std::size_t... I>(std::index_sequence<I...>) {
+            reportBatches(settings, "lock_list", "std::scoped_lock", static_cast<int>(Width), [&]() {
+                std::scoped_lock lock{mutexes[I]...};
+                ++rawValue;
+            });
+            reportBatches(settings, "lock_list", "LocksList", static_cast<int>(Width), [&]() {
+                (..., objects[I]) ->* ++(~objects[0]);
+            });
+        }(std::make_index_sequence<Width>{});
+    }
+
+    //Cheap per-thread pseudo-random numbers (xorshift), so that the generator does not dominate the measured operation.
+    struct Random {
+        std::uint64_t state;
+
+        explicit Random(std::uint64_t seed) : state{seed * 0x9E3779B97F4A7C15ull + 1} {}
+
+        std::uint64_t next() {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        }
+    };
+
+    //threads threads accessing the same object, writePercent% of the accesses exclusive (writes) and the others through a const reference (reads, shared if LockPolicy allows it).
+    template<typename LockPolicy>
+    void contention(const Settings& settings, const std::string& lockName, unsigned threads, unsigned writePercent) {
+        thread_safe::ThreadSafe<std::vector<long>, LockPolicy> table{std::vector<long>(64, 0)};
+        std::vector<std::vector<double>> latencies(threads);
+        std::atomic<bool> go{false};
+        std::vector<std::thread> pool;
+
+        for (unsigned t = 0; t < threads; ++t) {
+            pool.emplace_back([&, t]() {
+                Random random{t};
+                std::vector<double>& samples = latencies[t];
+                samples.reserve(settings.contendedOps);
+                while (!go.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+                long sink = 0;
+                for (int i = 0; i < settings.contendedOps; ++i) {
+                    std::uint64_t r = random.next();
+                    std::size_t slot = r % 64;
+                    auto start = Clock::now();
+                    if ((r >> 32) % 100 < writePercent) {
+                        table->at(slot) += 1;
+                    } else {
+                        sink += std::as_const(table)->at(slot);
+                    }
+                    samples.push_back(nanosecondsSince(start));
+                }
+                volatile long keep = sink;
+                (void)keep;
+            });
+        }
+
+        auto start = Clock::now();
+        go.store(true, std::memory_order_release);
+        for (auto& thread : pool) {
+            thread.join();
+        }
+        double seconds = nanosecondsSince(start) / 1e9;
+
+        std::vector<double> all;
+        for (auto& samples : latencies) {
+            all.insert(all.end(), samples.begin(), samples.end());
+        }
+        Percentiles p = percentilesOf(all);
+        JsonLine{}.field("benchmark", "contention").field("variant", lockName).field("threads", static_cast<int>(threads)).field("write_percent", static_cast<int>(writePercent))
+            .field("ops_per_sec", all.size() / seconds).latencies(p).print();
+    }
+
+}
+
+int main(int argc, char** argv) {
+    Settings settings;
+    if (flag(argc, argv, "quick")) {
+        settings.batches = 20;
+        settings.batchSize = 2'000;
+        settings.contendedOps = 10'000;
+    }
+    settings.maxThreads = static_cast<unsigned>(std::stoul(option(argc, argv, "threads", std::to_string(std::max(4u, std::thread::hardware_concurrency())))));
+
+    JsonLine{}.field("benchmark", "environment").field("hardware_threads", static_cast<int>(std::thread::hardware_concurrency())).field("max_threads", static_cast<int>(settings.maxThreads)).print();
+
+    uncontended<std::mutex>(settings, "std::mutex");
+    uncontended<thread_safe::SpinLock>(settings, "SpinLock");
+
+    lockList<2>(settings);
+    lockList<3>(settings);
+    lockList<4>(settings);
+    lockList<5>(settings);
+    lockList<6>(settings);
+    lockList<7>(settings);
+    lockList<8>(settings);
+
+    for (unsigned threads = 1; threads <= settings.maxThreads; threads *= 2) {
+        for (unsigned writePercent : {0u, 10u, 50u, 100u}) {
+            contention<std::mutex>(settings, "std::mutex", threads, writePercent);
+            contention<std::shared_mutex>(settings, "std::shared_mutex", threads, writePercent);
+        }
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef THREAD_SAFE_MEASUREMENTS
+#define THREAD_SAFE_MEASUREMENTS
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//Helpers shared by the benchmark and the stress test: latency samples, percentiles, and the JSON lines they print (one object per measurement, so that the output can be parsed by scripts and compared across runs).
+namespace measurements {
+
+    using Clock = std::chrono::steady_clock;
+
+    inline double nanosecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    }
+
+    //The latency percentiles of some samples (in nanoseconds).
+    struct Percentiles {
+        double p50 = 0;
+        double p90 = 0;
+        double p99 = 0;
+        double p999 = 0;
+        double max = 0;
+    };
+
+    //Computes the percentiles of samples, sorting it.
+    inline Percentiles percentilesOf(std::vector<double>& samples) {
+        Percentiles p;
+        if (samples.empty()) {
+            return p;
+        }
+        std::sort(samples.begin(), samples.end());
+        auto at = [&samples](double q) { return samples[std::min(samples.size() - 1, static_cast<std::size_t>(q * samples.size()))]; };
+        p.p50 = at(0.5);
+        p.p90 = at(0.9);
+        p.p99 = at(0.99);
+        p.p999 = at(0.999);
+        p.max = samples.back();
+        return p;
+    }
+
+    //A JSON object written on a single line: `JsonLine{}.field("name", "x").field("ns", 1.5).print();` prints {"name":"x","ns":1.5}.
+    class JsonLine {
+        std::ostringstream out;
+        bool first = true;
+
+        void key(std::string_view name) {
+            out << (first ? "{\"" : ",\"") << name << "\":";
+            first = false;
+        }
+
+        public:
+        JsonLine& field(std::string_view name, std::string_view value) {
+            key(name);
+            out << '"';
+            for (char c : value) {
+                if (c == '"' || c == '\\') {
+                    out << '\\';
+                }
+                out << c;
+            }
+            out << '"';
+            return *this;
+        }
+
+        JsonLine& field(std::string_view name, const char* value) {
+            return field(name, std::string_view{value});
+        }
+
+        JsonLine& field(std::string_view name, double value) {
+            key(name);
+            out << value;
+            return *this;
+        }
+
+        JsonLine& field(std::string_view name, std::uint64_t value) {
+            key(name);
+            out << value;
+            return *this;
+        }
+
+        JsonLine& field(std::string_view name, int value) {
+            key(name);
+            out << value;
+            return *this;
+        }
+
+        JsonLine& field(std::string_view name, bool value) {
+            key(name);
+            out << (value ? "true" : "false");
+            return *this;
+        }
+
+        //Adds the fields p50_ns, p90_ns, p99_ns, p999_ns and max_ns.
+        JsonLine& latencies(const Percentiles& p) {
+            return field("p50_ns", p.p50).field("p90_ns", p.p90).field("p99_ns", p.p99).field("p999_ns", p.p999).field("max_ns", p.max);
+        }
+
+        void print() {
+            out << (first ? "{}" : "}");
+            std::cout << out.str() << std::endl;
+        }
+    };
+
+    //The value of the command line option `--name=value`, or fallback if it is missing.
+    inline std::string option(int argc, char** argv, std::string_view name, std::string_view fallback) {
+        std::string prefix = "--" + std::string{name} + "=";
+        for (int i = 1; i < argc; ++i) {
+            std::string_view arg = argv[i];
+            if (arg.starts_with(prefix)) {
+                return std::string{arg.substr(prefix.size())};
+            }
+        }
+        return std::string{fallback};
+    }
+
+    //Whether the command line flag `--name` is present.
+    inline bool flag(int argc, char** argv, std::string_view name) {
+        std::string full = "--" + std::string{name};
+        for (int i = 1; i < argc; ++i) {
+            if (full == argv[i]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+}
+
+#endif
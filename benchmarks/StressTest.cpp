@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ThreadSafe.h"
+#include "Measurements.h"
+
+//Randomized multi-thread stress test: each scenario runs random operations on shared ThreadSafe objects from many threads for a while, then checks invariants which any lost update, torn write or lost wake-up would break. It is meant to be run under ThreadSanitizer too.
+//Each scenario prints a JSON line (see Measurements.h) with its throughput, latency percentiles and whether its invariants held; the exit code is non-zero if any did not.
+//Options: --seconds=S (duration of each scenario), --threads=N, --seed=X (to replay a run).
+
+using namespace measurements;
+
+namespace {
+
+    struct Settings {
+        double seconds = 1.0;
+        unsigned threads = 4;
+        std::uint64_t seed = 0;
+    };
+
+    struct Random {
+        std::uint64_t state;
+
+        explicit Random(std::uint64_t seed) : state{seed * 0x9E3779B97F4A7C15ull + 1} {}
+
+        std::uint64_t next() {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        }
+
+        //A number in [0, bound).
+        std::size_t below(std::size_t bound) {
+            return static_cast<std::size_t>(next() % bound);
+        }
+    };
+
+    std::atomic<int> inversions{0}; //Lock-order inversions reported by the library (see thread_safe::lockOrderReporter).
+
+    //Runs op(thread, random) repeatedly on settings.threads threads until settings.seconds have passed, timing each call. It returns the latencies of all of the calls.
+    template<typename Op>
+    std::vector<double> hammer(const Settings& settings, std::uint64_t scenarioSeed, Op op) {
+        std::vector<std::vector<double>> latencies(settings.threads);
+        std::vector<std::thread> pool;
+        auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(settings.seconds));
+        for (unsigned t = 0; t < settings.threads; ++t) {
+            pool.emplace_back([&, t]() {
+                Random random{settings.seed ^ (scenarioSeed * 1000 + t)};
+                while (Clock::now() < deadline) {
+                    auto start = Clock::now();
+                    op(t, random);
+                    latencies[t].push_back(nanosecondsSince(start));
+                }
+            });
+        }
+        for (auto& thread : pool) {
+            thread.join();
+        }
+        std::vector<double> all;
+        for (auto& samples : latencies) {
+            all.insert(all.end(), samples.begin(), samples.end());
+        }
+        return all;
+    }
+
+    bool report(const Settings& settings, const char* scenario, std::vector<double>& latencies, bool ok) {
+        std::uint64_t ops = latencies.size();
+        Percentiles p = percentilesOf(latencies);
+        JsonLine{}.field("scenario", scenario).field("threads", static_cast<int>(settings.threads)).field("ops", ops).field("ops_per_sec", ops / settings.seconds).latencies(p).field("ok", ok).print();
+        return ok;
+    }
+
+    //Money moved among accounts through lists, scoped locks, all-or-nothing tries and nested (re-entrant) accesses: the total never changes.
+    bool bank(const Settings& settings) {
+        constexpr std::size_t count = 8;
+        constexpr long initial = 1000;
+        std::array<thread_safe::ThreadSafe<long, std::mutex>, count> accounts;
+        for (auto& account : accounts) {
+            ~account = initial;
+        }
+        auto total = [&accounts]() {
+            return [&accounts]<std::size_t... I>(std::index_sequence<I...>) {
+                auto guard = thread_safe::lock(accounts[I]...);
+                return (guard.template get<I>() + ...);
+            }(std::make_index_sequence<count>{});
+        };
+        std::atomic<bool> audits{true};
+
+        std::vector<double> latencies = hammer(settings, 1, [&](unsigned, Random& random) {
+            std::size_t x = random.below(count), y = (x + 1 + random.below(count - 1)) % count;
+            long amount = static_cast<long>(random.below(10));
+            switch (random.below(5)) {
+                case 0:
+                    (accounts[x], accounts[y]) ->* ((~accounts[x]) -= amount, (~accounts[y]) += amount);
+                    break;
+                case 1: {
+                    auto [from, to] = thread_safe::lock(accounts[x], accounts[y]);
+                    from -= amount;
+                    to += amount;
+                    break;
+                }
+                case 2:
+                    if (auto guard = thread_safe::try_lock(accounts[x], accounts[y])) {
+                        guard->get<0>() -= amount;
+                        guard->get<1>() += amount;
+                    }
+                    break;
+                case 3: {
+                    //The outer guard holds the account with the lower address, so the nested list only waits for higher addresses.
+                    std::size_t low = std::min(x, y), high = std::max(x, y);
+                    auto outer = accounts[low].lock();
+                    *outer -= amount;
+                    (accounts[low], accounts[high]) ->* ((~accounts[high]) += amount);
+                    break;
+                }
+                default:
+                    if (total() != static_cast<long>(count) * initial) {
+                        audits = false;
+                    }
+                    break;
+            }
+        });
+        return report(settings, "bank", latencies, audits && total() == static_cast<long>(count) * initial);
+    }
+
+    //Money moved among versioned accounts by optimistic transactions, some of which also read a const object: the total never changes.
+    bool transactions(const Settings& settings) {
+        constexpr std::size_t count = 8;
+        constexpr long initial = 1000;
+        using Account = thread_safe::ThreadSafe<std::array<long, 4>, thread_safe::Versioned<>>;
+        std::array<Account, count> accounts;
+        for (auto& account : accounts) {
+            account->fill(initial);
+        }
+        thread_safe::ThreadSafe<long, thread_safe::Versioned<std::shared_mutex>> fee{1L};
+        const auto& readOnlyFee = fee;
+        auto total = [&accounts]() {
+            return [&accounts]<std::size_t... I>(std::index_sequence<I...>) {
+                auto guard = thread_safe::lock(std::as_const(accounts[I])...);
+                long sum = 0;
+                ((sum += guard.template get<I>()[0] + guard.template get<I>()[1] + guard.template get<I>()[2] + guard.template get<I>()[3]), ...);
+                return sum;
+            }(std::make_index_sequence<count>{});
+        };
+
+        std::vector<double> latencies = hammer(settings, 2, [&](unsigned, Random& random) {
+            std::size_t x = random.below(count), y = (x + 1 + random.below(count - 1)) % count, slot = random.below(4);
+            long amount = static_cast<long>(random.below(10));
+            if (random.below(2) == 0) {
+                thread_safe::atomically([slot, amount](auto& from, auto& to) { from[slot] -= amount; to[slot] += amount; }, accounts[x], accounts[y]);
+            } else {
+                thread_safe::atomically<1>([slot, amount](auto& from, auto& to, const long& f) { from[slot] -= amount * f; to[slot] += amount * f; }, accounts[x], accounts[y], readOnlyFee);
+            }
+        });
+        return report(settings, "transactions", latencies, total() == static_cast<long>(count) * initial * 4);
+    }
+
+    //Producers pushing to a ThreadSafeQueue (single elements and batches), consumers popping with the blocking and non-blocking operations: every element is popped exactly once.
+    bool queue(const Settings& settings) {
+        thread_safe::ThreadSafeQueue<std::uint64_t> elements{64};
+        unsigned consumers = std::max(1u, settings.threads / 2);
+        std::atomic<std::uint64_t> pushed{0}, popped{0};
+        std::vector<std::thread> pool;
+        for (unsigned c = 0; c < consumers; ++c) {
+            pool.emplace_back([&, c]() {
+                std::uint64_t sum = 0;
+                std::array<std::uint64_t, 8> batch;
+                for (bool done = false; !done;) {
+                    if (c % 2 == 0) {
+                        std::uint64_t value = elements.pop();
+                        done = value == 0;
+                        sum += value;
+                    } else {
+                        std::size_t n = elements.pop_n(batch.begin(), batch.size());
+                        for (std::size_t i = 0; i < n; ++i) {
+                            if (batch[i] == 0 && done) {
+                                elements.push(0); //The stop value of another consumer.
+                            }
+                            done = done || batch[i] == 0;
+                            sum += batch[i];
+                        }
+                    }
+                }
+                popped += sum;
+            });
+        }
+
+        Settings producers = settings;
+        producers.threads = std::max(1u, settings.threads - consumers);
+        std::vector<double> latencies = hammer(producers, 3, [&](unsigned, Random& random) {
+            std::uint64_t value = 1 + random.below(1000);
+            switch (random.below(3)) {
+                case 0:
+                    elements.push(value);
+                    pushed += value;
+                    break;
+                case 1:
+                    if (elements.try_push(value)) {
+                        pushed += value;
+                    }
+                    break;
+                default: {
+                    std::array<std::uint64_t, 4> batch{value, value, value, value};
+                    elements.push_n(batch.begin(), batch.size());
+                    pushed += 4 * value;
+                    break;
+                }
+            }
+        });
+        for (unsigned c = 0; c < consumers; ++c) {
+            elements.push(0); //Stops one consumer: the stop values follow all of the elements.
+        }
+        for (auto& thread : pool) {
+            thread.join();
+        }
+        return report(producers, "queue", latencies, pushed == popped && elements.empty());
+    }
+
+    //Producers appending to a ThreadSafe deque (some of them within a NotifyBatch), consumers sleeping in wait_until: every element is consumed exactly once and no consumer misses a wake-up (it would hang).
+    bool conditions(const Settings& settings) {
+        thread_safe::ThreadSafe<std::deque<std::uint64_t>> jobs;
+        unsigned consumers = std::max(1u, settings.threads / 2);
+        std::atomic<std::uint64_t> pushed{0}, popped{0};
+        std::vector<std::thread> pool;
+        for (unsigned c = 0; c < consumers; ++c) {
+            pool.emplace_back([&]() {
+                std::uint64_t sum = 0;
+                for (;;) {
+                    auto queue = jobs.wait_until([](const auto& q) { return !q.empty(); });
+                    std::uint64_t value = queue->front();
+                    queue->pop_front();
+                    if (value == 0) {
+                        break;
+                    }
+                    sum += value;
+                }
+                popped += sum;
+            });
+        }
+
+        Settings producers = settings;
+        producers.threads = std::max(1u, settings.threads - consumers);
+        std::vector<double> latencies = hammer(producers, 4, [&](unsigned, Random& random) {
+            std::uint64_t value = 1 + random.below(1000);
+            if (random.below(2) == 0) {
+                jobs->push_back(value);
+                pushed += value;
+            } else {
+                thread_safe::NotifyBatch batch;
+                jobs->push_back(value);
+                jobs->push_back(value);
+                pushed += 2 * value;
+            }
+        });
+        for (unsigned c = 0; c < consumers; ++c) {
+            jobs->push_back(0);
+        }
+        for (auto& thread : pool) {
+            thread.join();
+        }
+        return report(producers, "conditions", latencies, pushed == popped && jobs->empty());
+    }
+
+    //Lock-free counters, sharded maps and striped arrays updated at random: their totals match the number of increments.
+    bool counters(const Settings& settings) {
+        thread_safe::ThreadSafe<int> increments{0};
+        thread_safe::ThreadSafeShardedMap<int, long, 8> map;
+        thread_safe::ThreadSafeArray<long, 64, 4> array;
+
+        std::vector<double> latencies = hammer(settings, 5, [&](unsigned, Random& random) {
+            int key = static_cast<int>(random.below(100));
+            ++increments;
+            map.update(key, [](long& v) { ++v; });
+            array.apply(random.below(64), [](long& v) { ++v; });
+        });
+
+        long mapTotal = 0, arrayTotal = 0;
+        map.for_each([&mapTotal](const auto& entry) { mapTotal += entry.second; });
+        array.for_each_locked([&arrayTotal](long v) { arrayTotal += v; });
+        long expected = *increments;
+        return report(settings, "counters", latencies, expected == static_cast<long>(latencies.size()) && mapTotal == expected && arrayTotal == expected);
+    }
+
+    //Coroutine awaiting an AsyncMutex: each of its increments is released to the next waiter, which is often a thread blocked in AsyncMutex::lock. It only suspends on the mutex, since it may be resumed on the thread releasing it, where its scheduler must not be touched.
+    thread_safe::TestScheduler::Task incrementAsync(thread_safe::AsyncThreadSafe<long>& counter, int times) {
+        for (int i = 0; i < times; ++i) {
+            auto guard = co_await counter.lock_async();
+            ++*guard;
+        }
+    }
+
+    //Threads locking an AsyncMutex (parking until it is handed over to them) while coroutines on other threads lock and release it: no increment is lost, and no thread is woken up through a waiter it has already destroyed.
+    bool asyncMutex(const Settings& settings) {
+        constexpr int coroutines = 4, increments = 8;
+        thread_safe::AsyncThreadSafe<long> counter{0L};
+        std::atomic<long> expected{0};
+
+        std::vector<double> latencies = hammer(settings, 6, [&](unsigned t, Random& random) {
+            if (t % 2 == 0) {
+                for (std::size_t i = 1 + random.below(4); i > 0; --i) {
+                    ++*counter;
+                    ++expected;
+                }
+            } else {
+                thread_safe::TestScheduler scheduler;
+                for (int c = 0; c < coroutines; ++c) {
+                    scheduler.spawn(incrementAsync(counter, increments));
+                }
+                scheduler.run(); //The coroutines still waiting for the mutex are resumed by the threads releasing it, before they return.
+                expected += coroutines * increments;
+            }
+        });
+        return report(settings, "async_mutex", latencies, *counter == expected);
+    }
+
+}
+
+int main(int argc, char** argv) {
+    Settings settings;
+    settings.seconds = std::stod(option(argc, argv, "seconds", "1"));
+    settings.threads = static_cast<unsigned>(std::stoul(option(argc, argv, "threads", std::to_string(std::max(4u, std::thread::hardware_concurrency())))));
+    settings.seed = std::stoull(option(argc, argv, "seed", std::to_string(std::random_device{}())));
+
+#if THREAD_SAFE_LOCK_ORDER_CHECKS
+    thread_safe::lockOrderReporter = [](const thread_safe::LockOrderInversion& inversion) {
+        thread_safe::printLockOrderInversion(inversion);
+        ++inversions;
+    };
+#endif
+
+    bool ok = true;
+    ok = bank(settings) && ok;
+    ok = transactions(settings) && ok;
+    ok = queue(settings) && ok;
+    ok = conditions(settings) && ok;
+    ok = counters(settings) && ok;
+    ok = asyncMutex(settings) && ok;
+    ok = ok && inversions == 0;
+
+    JsonLine{}.field("scenario", "summary").field("seed", settings.seed).field("lock_order_inversions", inversions.load()).field("ok", ok).print();
+    return ok ? 0 : 1;
+}
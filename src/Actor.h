@@ -0,0 +1,265 @@
+#ifndef THREAD_SAFE_ACTOR
+#define THREAD_SAFE_ACTOR
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "LockPolicies.h"
+#include "Conditions.h"
+#include "HeldLocks.h"
+
+//Actor lock policy: the operations posted to a ThreadSafe object are queued and run one at a time by a shared pool of worker threads, so the callers never wait for the lock.
+namespace thread_safe {
+
+	//A job run by the WorkerPool. Jobs are intrusive, so submitting one never allocates.
+	struct PoolJob {
+		PoolJob* next = nullptr; //The next job in the queue of the pool.
+		void (*run)(PoolJob* job) = nullptr;
+	};
+
+	/**
+	 * @class WorkerPool
+	 * @brief The threads running the operations posted to the ThreadSafe objects (see BasicActor), shared by the whole program.
+	 * @details The pool is created the first time a job is submitted, with one thread per hardware thread (at least 2), and it runs all of the submitted jobs before being destroyed at the end of the program.
+	**/
+	class WorkerPool {
+		std::mutex mtx;
+		std::condition_variable ready;
+		PoolJob* first = nullptr; //The queue of the submitted jobs, guarded by mtx.
+		PoolJob* last = nullptr;
+		bool stopping = false;
+		std::vector<std::thread> workers;
+
+		WorkerPool() {
+			unsigned count = std::max(2u, std::thread::hardware_concurrency());
+			for (unsigned i = 0; i < count; ++i) {
+				workers.emplace_back([this]() { work(); });
+			}
+		}
+
+		void work() {
+			for (;;) {
+				PoolJob* job;
+				{
+					std::unique_lock guard{mtx};
+					ready.wait(guard, [this]() { return first || stopping; });
+					if (!first) {
+						return;
+					}
+					job = std::exchange(first, first->next);
+					if (!first) {
+						last = nullptr;
+					}
+				}
+				job->run(job);
+			}
+		}
+
+		public:
+		static WorkerPool& instance() {
+			static WorkerPool pool;
+			return pool;
+		}
+
+		~WorkerPool() {
+			{
+				std::lock_guard guard{mtx};
+				stopping = true;
+			}
+			ready.notify_all();
+			for (auto& worker : workers) {
+				worker.join();
+			}
+		}
+
+		//Queues job, which must stay alive until it has been run.
+		void submit(PoolJob& job) {
+			job.next = nullptr;
+			{
+				std::lock_guard guard{mtx};
+				(last ? last->next : first) = &job;
+				last = &job;
+			}
+			ready.notify_one();
+		}
+	};
+
+	//An operation posted to an actor. It is allocated by the thread posting it, and run and deleted by the worker draining the actor.
+	struct ActorTask {
+		std::atomic<ActorTask*> next{nullptr};
+		void (*run)(ActorTask* task) = nullptr;
+	};
+
+	/**
+	 * @class MpscQueue
+	 * @brief Intrusive lock-free multi-producer single-consumer queue of ActorTask (D. Vyukov's algorithm).
+	 * @details push is wait-free. pop may return nullptr while a push is halfway done: the consumer knows how many tasks have been pushed (see BasicActor), so it simply tries again.
+	**/
+	class MpscQueue {
+		ActorTask stub; //Dummy node, so that the queue is never empty.
+		std::atomic<ActorTask*> tail{&stub}; //The last pushed task, shared by the producers.
+		ActorTask* head = &stub; //The next task to pop, only accessed by the consumer.
+
+		public:
+		MpscQueue() = default;
+		MpscQueue(const MpscQueue&) = delete;
+		MpscQueue& operator=(const MpscQueue&) = delete;
+
+		void push(ActorTask* task) {
+			task->next.store(nullptr, std::memory_order_relaxed);
+			ActorTask* previous = tail.exchange(task, std::memory_order_acq_rel);
+			previous->next.store(task, std::memory_order_release);
+		}
+
+		ActorTask* pop() {
+			ActorTask* h = head;
+			ActorTask* next = h->next.load(std::memory_order_acquire);
+			if (h == &stub) {
+				if (!next) {
+					return nullptr;
+				}
+				head = h = next;
+				next = next->next.load(std::memory_order_acquire);
+			}
+			if (next) {
+				head = next;
+				return h;
+			}
+			if (h != tail.load(std::memory_order_acquire)) {
+				return nullptr;
+			}
+			push(&stub);
+			next = h->next.load(std::memory_order_acquire);
+			if (next) {
+				head = next;
+				return h;
+			}
+			return nullptr;
+		}
+	};
+
+	/**
+	 * @class BasicActor
+	 * @brief Lock policy turning a ThreadSafe object into an actor: ThreadSafe::post and ThreadSafe::async queue an operation and return at once, and the operations are run one at a time by the WorkerPool.
+	 * @details The operations are pushed on a lock-free MpscQueue owned by the object. The push which makes the queue non-empty submits the object to the WorkerPool, whose worker runs up to maxBatch operations holding the internal lock of the ThreadSafe object (so the batches are recorded in its statistics, if enabled), then submits the object again if more operations are queued.
+	 * The worker records the lock in HeldLocks while running each operation, so an operation can access its own object again, as any other access holding it.
+	 * The object can still be accessed through `->`, `*` and comma separated lists, which lock WriterLock: they simply wait for the batch being run.
+	 * Each batch wakes up, once it has been run, the threads waiting for a change of the object (see ThreadSafe::wait_until).
+	 * The destructor waits until all of the queued operations have been run. Exceptions thrown by operations queued through post are discarded (use async to get them).
+		 * @tparam WriterLock The lock protecting the object.
+	**/
+	template<Lockable WriterLock = std::mutex>
+	class BasicActor : public WriterLock {
+		static constexpr std::size_t maxBatch = 64; //How many operations a worker runs before submitting the object again, so that a busy actor does not monopolize a worker.
+
+		template<typename Object, typename Function>
+		struct Task : ActorTask {
+			Object& object;
+			Function fn;
+
+			template<typename F>
+			Task(Object& object, F&& fn) : object{object}, fn(std::forward<F>(fn)) {
+				run = &Task::execute;
+			}
+
+			static void execute(ActorTask* task) {
+				std::unique_ptr<Task> self{static_cast<Task*>(task)};
+				try {
+					std::invoke(self->fn, self->object);
+				} catch (...) {
+				}
+			}
+		};
+
+		struct DrainJob : PoolJob {
+			BasicActor* actor;
+			void* lock = nullptr; //The internal lock of the ThreadSafe object, of the type drain has been instantiated for.
+		};
+
+		MpscQueue tasks;
+		std::atomic<std::size_t> pending{0}; //How many tasks have been pushed and not yet run. The object is submitted to the pool when it becomes positive.
+		DrainJob job; //The job draining this object: it is submitted at most once at a time.
+
+		//Runs a batch of the queued operations holding lock, the internal lock of the ThreadSafe object (this policy, possibly wrapped). Nothing in the object is touched after pending has been decreased, since from then on the object may be destroyed.
+		template<typename Lock>
+		static void drain(PoolJob* drainJob) {
+			BasicActor& self = *static_cast<DrainJob*>(drainJob)->actor;
+			Lock& lock = *static_cast<Lock*>(static_cast<DrainJob*>(drainJob)->lock);
+			std::size_t count = std::min(self.pending.load(std::memory_order_acquire), maxBatch);
+			{
+				std::lock_guard guard{lock};
+				for (std::size_t i = 0; i < count; ++i) {
+					ActorTask* task;
+					while (!(task = self.tasks.pop())) {
+						std::this_thread::yield(); //A producer is halfway through its push.
+					}
+					HoldingLock holding{lock};
+					task->run(task);
+				}
+			}
+			notifyWaiters(&lock);
+			if (self.pending.fetch_sub(count, std::memory_order_acq_rel) != count) {
+				WorkerPool::instance().submit(self.job);
+			}
+		}
+
+		public:
+		BasicActor() {
+			job.actor = this;
+		}
+
+		BasicActor(const BasicActor&) = delete;
+		BasicActor& operator=(const BasicActor&) = delete;
+
+		~BasicActor() {
+			waitIdle();
+		}
+
+		//Waits until all of the queued operations have been run. The ThreadSafe object calls it on destruction, before its wrapped object is destroyed.
+		void waitIdle() {
+			while (pending.load(std::memory_order_acquire) != 0) {
+				std::this_thread::yield();
+			}
+		}
+
+		/**
+		 * @brief Queues fn, to be run on object by the WorkerPool.
+		 * @param lock The lock the worker takes to run the operations: it is this policy, possibly wrapped (e.g. by InstrumentedLock).
+		 * @param object The protected object.
+		 * @param fn The operation to run.
+		**/
+		template<Lockable Lock, typename Object, typename Function>
+		void post(Lock& lock, Object& object, Function&& fn) {
+			tasks.push(new Task<Object, std::decay_t<Function>>{object, std::forward<Function>(fn)});
+			if (pending.fetch_add(1, std::memory_order_acq_rel) == 0) {
+				//No batch is running (the last one decreased pending to 0 and does not touch the job anymore), so the job can be set up.
+				job.lock = &lock;
+				job.run = &BasicActor::drain<Lock>;
+				WorkerPool::instance().submit(job);
+			}
+		}
+	};
+
+	using Actor = BasicActor<>;
+
+	template<typename LockPolicy>
+	struct IsActor : std::false_type {};
+
+	template<Lockable WriterLock>
+	struct IsActor<BasicActor<WriterLock>> : std::true_type {};
+
+	//A lock policy running the operations posted through ThreadSafe::post and ThreadSafe::async on the WorkerPool.
+	template<typename LockPolicy>
+	concept ActorLockable = IsActor<LockPolicy>::value;
+
+}
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef THREAD_SAFE_ATOMIC
+#define THREAD_SAFE_ATOMIC
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include "LockPolicies.h"
+#include "HeldLocks.h"
+#include "Conditions.h"
+
+//Lock-free mode of ThreadSafe, automatically selected for small arithmetic types (counters, flags...). This header is included at the end of ThreadSafe.h.
+namespace thread_safe {
+
+	/**
+	 * @class ThreadSafe<WrappedType, AtomicWord<WrappedType>>
+	 * @brief ThreadSafe object whose single operations are lock-free: it is the default for any WrappedType satisfying AtomicWordType (e.g. `ThreadSafe<int>`).
+	 * @details There is no Temp object: `*` returns a copy of the value, while the assignment and the compound assignment operators (and fetch_update for any other operation) atomically modify it with a compare-and-swap loop.
+	 * The object can still be part of a comma separated list, like any other ThreadSafe object: in this case its AtomicWord is locked and, for the duration of the statement, `~` gives access to the value held by the lock. Outside of such statements (or of a guard returned by lock) `~` throws, since there is no value it could safely return: code using `~counter` as an unprotected access must use an explicit lock policy.
+	 * While the current thread holds the lock through a list, the single operations work directly on the value held by the lock, instead of waiting for it (see HeldLocks).
+	 * wait_until sleeps until the value satisfies a predicate: each update wakes up the waiting threads.
+	 * Use an explicit lock policy (e.g. `ThreadSafe<int, std::mutex>`) to get the usual behaviour.
+	 * @tparam WrappedType The type of the protected value.
+	**/
+	template<AtomicWordType WrappedType>
+	class ThreadSafe<WrappedType, AtomicWord<WrappedType>> {
+		mutable AtomicWord<WrappedType> mtx; //Both the value and the lock taken by LocksList. It is mutable because const objects are locked too when they are part of a list.
+
+		//Whether the current thread holds mtx through a comma separated list: the value is then in lockedValue, and waiting for the lock would never end.
+		bool heldByThisThread() const {
+			return HeldLocks::reenters(&mtx, true);
+		}
+
+		//Returns the current value.
+		WrappedType load() const {
+			return heldByThisThread() ? mtx.lockedValue() : mtx.load();
+		}
+
+		//Atomically replaces the value v with fn(v) and returns v, waking up the threads waiting for a change. Inside a list the waiters are woken up by the list, when it releases the lock.
+		template<typename Function>
+		WrappedType fetchUpdate(Function&& fn) {
+			if (heldByThisThread()) {
+				WrappedType& value = mtx.lockedValue();
+				return std::exchange(value, static_cast<WrappedType>(fn(value)));
+			}
+			WrappedType old = mtx.fetchUpdate(std::forward<Function>(fn));
+			notifyWaiters(&mtx);
+			return old;
+		}
+
+		//Implementation of try_access and access_until, for both the const and the non-const objects: the lock is tried repeatedly until deadline (only once if deadline is empty).
+		template<typename Self, typename Deadline = std::chrono::steady_clock::time_point>
+		static auto tryAccessUntil(Self& self, std::optional<Deadline> deadline = std::nullopt) {
+			using Access = std::optional<std::conditional_t<std::is_const_v<Self>, ConstTemp, Temp>>;
+			if (self.heldByThisThread()) {
+				return Access{std::in_place, self};
+			}
+			while (!self.mtx.try_lock()) {
+				if (!deadline || Deadline::clock::now() >= *deadline) {
+					return Access{};
+				}
+				std::this_thread::yield();
+			}
+			return Access{std::in_place, self, std::adopt_lock};
+		}
+
+		//Whether the thread waiting for pred must sleep. It is called by the parking lot, after the waiter has been counted: if a list holds the lock, it will wake up the waiter when it releases it.
+		template<typename Predicate>
+		bool mustWait(Predicate& pred) const {
+			WrappedType value;
+			return !mtx.tryLoad(value) || !std::invoke(pred, value);
+		}
+
+		//Atomically replaces the value v with fn(v) and returns the new value.
+		template<typename Function>
+		WrappedType updateFetch(Function fn) {
+			WrappedType updated;
+			fetchUpdate([&fn, &updated](WrappedType v) { return updated = static_cast<WrappedType>(fn(v)); });
+			return updated;
+		}
+
+
+		/**
+		 * @class BasicTemp
+		 * @brief Guard holding the lock of the AtomicWord: while it exists the value can be read and written in place, through `*` or `->`, and it is written back when the guard is destroyed.
+		 * @details The lock is recorded in HeldLocks, as Temp objects of the other ThreadSafe objects do, so the single operations and `~` of the same thread work on the locked value. It cannot be moved, but it is initialized in place thanks to guaranteed copy elision.
+		 * @tparam ReadOnly Whether the guard grants read-only access. The lock is exclusive anyway, since an AtomicWord has no shared mode.
+		**/
+		template<bool ReadOnly>
+		class BasicTemp : public TempBase {
+			using Owner = std::conditional_t<ReadOnly, const ThreadSafe, ThreadSafe>;
+			using Reference = std::conditional_t<ReadOnly, const WrappedType&, WrappedType&>;
+
+			Owner& owner;
+			LockHandle handle;
+
+			public:
+			//Locks the AtomicWord of owner, unless the current thread already holds it.
+			explicit BasicTemp(Owner& owner) : owner{owner}, handle{LockHandle::of<false>(owner.mtx)} {
+				handle.lock();
+			}
+
+			//Adopts the lock of owner, already acquired by the current thread.
+			BasicTemp(Owner& owner, std::adopt_lock_t) : owner{owner}, handle{LockHandle::of<false>(owner.mtx)} {
+				handle.adopt();
+			}
+
+			BasicTemp(const BasicTemp&) = delete;
+			BasicTemp& operator=(const BasicTemp&) = delete;
+
+			~BasicTemp() {
+				handle.unlock();
+			}
+
+			Reference operator*() const {
+				return owner.mtx.lockedValue();
+			}
+
+			std::remove_reference_t<Reference>* operator->() const {
+				return &owner.mtx.lockedValue();
+			}
+
+			operator Reference() const {
+				return owner.mtx.lockedValue();
+			}
+		};
+
+
+		public:
+		using Temp = BasicTemp<false>; //Guard granting read-write access.
+		using ConstTemp = BasicTemp<true>; //Guard granting read-only access.
+
+		/**
+		 * @brief Constructs a ThreadSafe object storing value.
+		 * @param value The initial value.
+		**/
+		ThreadSafe(WrappedType value = WrappedType{}) : mtx{value} {
+			THREAD_SAFE_TRACE(ThreadSafeCtor, this);
+		}
+
+		ThreadSafe(const ThreadSafe& ts) : mtx{ts.load()} {
+			THREAD_SAFE_TRACE(ThreadSafeCopyCtor, this);
+		}
+
+		ThreadSafe& operator=(const ThreadSafe& ts) {
+			THREAD_SAFE_TRACE(ThreadSafeCopyAssign, this);
+			return *this = ts.load();
+		}
+
+		//Atomically replaces the value.
+		ThreadSafe& operator=(WrappedType value) {
+			fetchUpdate([value](WrappedType) { return value; });
+			return *this;
+		}
+
+		/**
+		 * @brief Reads the value.
+		 * @return A copy of the current value.
+		**/
+		WrappedType operator*() const {
+			THREAD_SAFE_TRACE(ThreadSafeConstDereference, this);
+			return load();
+		}
+
+		/**
+		 * @brief Locks the value for a whole scope, as ThreadSafe::lock does: the single operations of the other threads wait until the returned guard is destroyed.
+		 * @details It is meant for the code which works on any ThreadSafe object, and for the operations which cannot be expressed as a single update: since the value is written back only on release, it costs more than fetch_update.
+		 * @return A Temp object holding the lock.
+		**/
+		Temp lock() {
+			return Temp{*this};
+		}
+
+		//Read-only version of lock.
+		ConstTemp lock() const {
+			return ConstTemp{*this};
+		}
+
+		//Same as lock: `->` of the other ThreadSafe objects locks them for the rest of the statement.
+		Temp operator->() {
+			return Temp{*this};
+		}
+
+		ConstTemp operator->() const {
+			return ConstTemp{*this};
+		}
+
+		//Locks the value only if it is not locked, without waiting (see ThreadSafe::try_access).
+		std::optional<Temp> try_access() {
+			return tryAccessUntil(*this);
+		}
+
+		std::optional<ConstTemp> try_access() const {
+			return tryAccessUntil(*this);
+		}
+
+		//Locks the value, waiting at most until deadline (see ThreadSafe::access_until). The lock is tried repeatedly, since an AtomicWord cannot be waited for with a timeout.
+		template<typename Clock, typename Duration>
+		std::optional<Temp> access_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+			return tryAccessUntil(*this, std::optional{deadline});
+		}
+
+		template<typename Clock, typename Duration>
+		std::optional<ConstTemp> access_until(const std::chrono::time_point<Clock, Duration>& deadline) const {
+			return tryAccessUntil(*this, std::optional{deadline});
+		}
+
+		//Locks the value, waiting at most for timeout.
+		template<typename Rep, typename Period>
+		std::optional<Temp> access_for(const std::chrono::duration<Rep, Period>& timeout) {
+			return access_until(std::chrono::steady_clock::now() + timeout);
+		}
+
+		template<typename Rep, typename Period>
+		std::optional<ConstTemp> access_for(const std::chrono::duration<Rep, Period>& timeout) const {
+			return access_until(std::chrono::steady_clock::now() + timeout);
+		}
+
+		/**
+		 * @brief Runs fn on the value with the lock held, and returns its result (see ThreadSafe::apply).
+		 * @details Unlike fetch_update, fn is called exactly once, so it can have side effects, at the cost of locking: the single operations of the other threads wait for it.
+		 * @tparam Function A callable accepting a WrappedType&.
+		 * @param fn The operation to run.
+		 * @return The value returned by fn.
+		**/
+		template<std::invocable<WrappedType&> Function>
+		auto apply(Function&& fn) {
+			THREAD_SAFE_TRACE(ThreadSafeApply, this);
+			using Result = std::decay_t<std::invoke_result_t<Function&, WrappedType&>>;
+			Temp guard{*this};
+			return static_cast<Result>(std::invoke(fn, *guard));
+		}
+
+		//Same as ts.apply(fn).
+		template<std::invocable<WrappedType&> Function>
+		friend auto operator->*(ThreadSafe& ts, Function&& fn) {
+			return ts.apply(std::forward<Function>(fn));
+		}
+
+		/**
+		 * @brief Atomically replaces the value v with fn(v).
+		 * @details fn may be called more than once, if other threads modify the value in the meanwhile, so it should have no side effects.
+		 * @tparam Function A callable accepting a WrappedType and returning a value convertible to WrappedType.
+		 * @param fn The operation to apply.
+		 * @return The value before the update.
+		**/
+		template<typename Function>
+		WrappedType fetch_update(Function&& fn) {
+			THREAD_SAFE_TRACE(ThreadSafeUpdate, this);
+			return fetchUpdate(std::forward<Function>(fn));
+		}
+
+		/**
+		 * @brief Waits until pred holds for the value, sleeping (instead of polling) while it does not.
+		 * @details The calling thread must not hold the lock through a list, unless pred holds: nobody else could change the value.
+		 * @tparam Predicate A callable accepting a WrappedType and returning whether the wait is over.
+		 * @param pred The condition to wait for.
+		 * @return The value for which pred holds. Other threads may have changed it since.
+		**/
+		template<std::predicate<WrappedType> Predicate>
+		WrappedType wait_until(Predicate&& pred) const {
+			THREAD_SAFE_TRACE(ThreadSafeWait, this);
+			for (;;) {
+				WrappedType value = load();
+				if (std::invoke(pred, value)) {
+					return value;
+				}
+				ConditionLot::park(&mtx, [this, &pred]() { return mustWait(pred); });
+			}
+		}
+
+		/**
+		 * @brief Waits until pred holds for the value (see wait_until), at most until deadline.
+		 * @return The value for which pred holds, or an empty optional if deadline expired first.
+		**/
+		template<std::predicate<WrappedType> Predicate, typename Clock, typename Duration>
+		std::optional<WrappedType> wait_until(Predicate&& pred, const std::chrono::time_point<Clock, Duration>& deadline) const {
+			THREAD_SAFE_TRACE(ThreadSafeWait, this);
+			for (;;) {
+				WrappedType value = load();
+				if (std::invoke(pred, value)) {
+					return value;
+				}
+				if (Clock::now() >= deadline) {
+					return std::nullopt;
+				}
+				ConditionLot::parkUntil(&mtx, [this, &pred]() { return mustWait(pred); }, deadline);
+			}
+		}
+
+		//Waits until pred holds for the value (see wait_until), at most for timeout.
+		template<std::predicate<WrappedType> Predicate, typename Rep, typename Period>
+		std::optional<WrappedType> wait_for(Predicate&& pred, const std::chrono::duration<Rep, Period>& timeout) const {
+			return wait_until(std::forward<Predicate>(pred), std::chrono::steady_clock::now() + timeout);
+		}
+
+		///@{
+		//Atomic compound assignments: they return the new value.
+		WrappedType operator+=(WrappedType rhs) { return updateFetch([rhs](WrappedType v) { return v + rhs; }); }
+		WrappedType operator-=(WrappedType rhs) { return updateFetch([rhs](WrappedType v) { return v - rhs; }); }
+		WrappedType operator*=(WrappedType rhs) { return updateFetch([rhs](WrappedType v) { return v * rhs; }); }
+		WrappedType operator/=(WrappedType rhs) { return updateFetch([rhs](WrappedType v) { return v / rhs; }); }
+		WrappedType operator%=(WrappedType rhs) requires std::integral<WrappedType> { return updateFetch([rhs](WrappedType v) { return v % rhs; }); }
+		WrappedType operator&=(WrappedType rhs) requires std::integral<WrappedType> { return updateFetch([rhs](WrappedType v) { return v & rhs; }); }
+		WrappedType operator|=(WrappedType rhs) requires std::integral<WrappedType> { return updateFetch([rhs](WrappedType v) { return v | rhs; }); }
+		WrappedType operator^=(WrappedType rhs) requires std::integral<WrappedType> { return updateFetch([rhs](WrappedType v) { return v ^ rhs; }); }
+		WrappedType operator<<=(int rhs) requires std::integral<WrappedType> { return updateFetch([rhs](WrappedType v) { return v << rhs; }); }
+		WrappedType operator>>=(int rhs) requires std::integral<WrappedType> { return updateFetch([rhs](WrappedType v) { return v >> rhs; }); }
+		///@}
+
+		///@{
+		//Atomic increments and decrements: the prefix forms return the new value, the postfix forms the old one.
+		WrappedType operator++() { return *this += WrappedType{1}; }
+		WrappedType operator--() { return *this -= WrappedType{1}; }
+		WrappedType operator++(int) { return fetchUpdate([](WrappedType v) { return v + WrappedType{1}; }); }
+		WrappedType operator--(int) { return fetchUpdate([](WrappedType v) { return v - WrappedType{1}; }); }
+		///@}
+
+		/**
+		 * @brief Gives access to the value held by the lock, while the current thread holds it through a comma separated list or a Temp object.
+		 * @details E.g. `(counter, log) ->* ++(~counter)`: the value is written back when the list releases its locks. Without the lock there is no such value, and a write would be lost, so a std::system_error with code std::errc::operation_not_permitted is thrown instead (in every build).
+		 * @return The value held by the lock.
+		**/
+		WrappedType& operator~() {
+			THREAD_SAFE_TRACE(ThreadSafeTilde, this);
+			if (!heldByThisThread()) {
+				throw std::system_error{std::make_error_code(std::errc::operation_not_permitted), "~ on a lock-free ThreadSafe object needs the lock: use it within a list or a guard returned by lock()"};
+			}
+			return mtx.lockedValue();
+		}
+
+		//It does nothing: the single operations are lock-free, so there is no contention to record.
+		void registerAs([[maybe_unused]] std::string_view name) {
+		}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///										FRIENDS												///
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		template<std::size_t N> friend class LocksList; //LocksList objects lock mtx.
+	};
+
+}
+
+#endif
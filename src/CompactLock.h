@@ -0,0 +1,257 @@
+#ifndef THREAD_SAFE_COMPACT_LOCK
+#define THREAD_SAFE_COMPACT_LOCK
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include "LockPolicies.h"
+
+//Compact lock policy: a one-byte lock whose waiting threads are parked in a global hashed table, so that millions of small ThreadSafe objects do not each embed a full kernel-backed mutex.
+namespace thread_safe {
+
+	/**
+	 * @class BasicParkingLot
+	 * @brief Global table where threads wait (are parked) on behalf of an address, so that the objects they wait for do not need to store any waiting machinery.
+	 * @details The address is hashed to one of bucketCount buckets, each one with its own mutex and the queue of the threads parked in it (which can be waiting for different addresses). Each parked thread waits on its own condition variable, so unparking one of them does not wake up the others.
+	 * Each Domain has its own table, so threads parked on the same address for different reasons (e.g. waiting for a CompactLock or for a change of the object it protects) never wake up each other.
+	 * The table is created the first time it is used, and lives until the end of the program.
+	 * @tparam Domain A tag type selecting the table.
+	**/
+	template<typename Domain>
+	class BasicParkingLot {
+		static constexpr std::size_t bucketCount = 256;
+
+		//A parked thread. It lives on the stack of the thread, which waits until unparked is set.
+		struct Parked {
+			const void* address;
+			Parked* next = nullptr;
+			bool unparked = false; //Guarded by the mutex of the bucket.
+			std::condition_variable wakeUp;
+
+			explicit Parked(const void* address) : address{address} {}
+		};
+
+		struct alignas(cacheLineSize) Bucket {
+			std::mutex mtx;
+			Parked* first = nullptr; //The parked threads, in arrival order.
+			Parked* last = nullptr;
+			std::atomic<std::size_t> parking{0}; //How many threads are parked, or about to be, in this bucket (see mayHaveParked).
+		};
+
+		std::array<Bucket, bucketCount> buckets;
+
+		BasicParkingLot() = default;
+
+		static BasicParkingLot& instance() {
+			static BasicParkingLot lot;
+			return lot;
+		}
+
+		static Bucket& bucketOf(const void* address) {
+			std::uint64_t mixed = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(address)) * 0x9E3779B97F4A7C15ull;
+			return instance().buckets[(mixed >> 32) % bucketCount];
+		}
+
+		//Removes p, which follows previous (or is the first one if previous is null), from the queue of bucket.
+		static void unlink(Bucket& bucket, Parked* previous, Parked* p) {
+			(previous ? previous->next : bucket.first) = p->next;
+			if (bucket.last == p) {
+				bucket.last = previous;
+			}
+		}
+
+		//Parks the calling thread on address if shouldPark returns true, until it is unparked or wait (which waits on the condition variable of the parked thread) returns false.
+		template<typename Validate, typename Wait>
+		static bool parkWith(const void* address, Validate& shouldPark, Wait&& wait) {
+			Bucket& bucket = bucketOf(address);
+			std::unique_lock guard{bucket.mtx};
+			bucket.parking.fetch_add(1, std::memory_order_seq_cst);
+			std::atomic_thread_fence(std::memory_order_seq_cst); //Orders the increment before the reads of shouldPark (see mayHaveParked).
+			struct Leaving {
+				Bucket& bucket;
+				~Leaving() { bucket.parking.fetch_sub(1, std::memory_order_relaxed); }
+			} leaving{bucket};
+			if (!shouldPark()) {
+				return false;
+			}
+			Parked self{address};
+			(bucket.last ? bucket.last->next : bucket.first) = &self;
+			bucket.last = &self;
+			if (!wait(self.wakeUp, guard, [&self]() { return self.unparked; })) {
+				Parked* previous = nullptr;
+				for (Parked* p = bucket.first; p != &self; p = p->next) {
+					previous = p;
+				}
+				unlink(bucket, previous, &self);
+			}
+			return true;
+		}
+
+		public:
+		/**
+		 * @brief Parks the calling thread on address, if shouldPark still returns true.
+		 * @details shouldPark is called with the bucket locked, so it is serialized with unparkOne: a thread which changes the state checked by shouldPark before calling unparkOne cannot be missed.
+		 * @param address The address to wait for.
+		 * @param shouldPark Tells whether the thread still needs to wait.
+		 * @return Whether the thread has been parked (and then unparked).
+		**/
+		template<typename Validate>
+		static bool park(const void* address, Validate&& shouldPark) {
+			return parkWith(address, shouldPark, [](std::condition_variable& cv, std::unique_lock<std::mutex>& guard, auto unparked) {
+				cv.wait(guard, unparked);
+				return true;
+			});
+		}
+
+		//Same as park, but the thread stops waiting at deadline even if it has not been unparked.
+		template<typename Validate, typename Clock, typename Duration>
+		static bool parkUntil(const void* address, Validate&& shouldPark, const std::chrono::time_point<Clock, Duration>& deadline) {
+			return parkWith(address, shouldPark, [&deadline](std::condition_variable& cv, std::unique_lock<std::mutex>& guard, auto unparked) {
+				return cv.wait_until(guard, deadline, unparked);
+			});
+		}
+
+		/**
+		 * @brief Tells whether some thread may be parked on address, without locking anything: if it returns false, unparking would find no thread.
+		 * @details A thread is counted before its shouldPark is called. So a thread which changes the state checked by shouldPark with a sequentially consistent operation (or under a lock also taken around shouldPark), and then gets false from this function, is guaranteed that no thread is parking on a stale state.
+		**/
+		static bool mayHaveParked(const void* address) {
+			return bucketOf(address).parking.load(std::memory_order_seq_cst) != 0;
+		}
+
+		/**
+		 * @brief Unparks the first thread parked on address, if any.
+		 * @details callback is called with the bucket locked, before the thread is woken up, with whether a thread is being unparked and whether other threads are still parked on address: it is the place to update the state checked by the shouldPark of park.
+		 * @param address The address whose waiter is woken up.
+		 * @param callback A callable accepting (bool unparked, bool mayHaveMore).
+		**/
+		template<typename Callback>
+		static void unparkOne(const void* address, Callback&& callback) {
+			Bucket& bucket = bucketOf(address);
+			std::lock_guard guard{bucket.mtx};
+			Parked* previous = nullptr;
+			Parked* found = bucket.first;
+			while (found && found->address != address) {
+				previous = std::exchange(found, found->next);
+			}
+			if (found) {
+				unlink(bucket, previous, found);
+			}
+
+			bool mayHaveMore = false;
+			for (Parked* p = found ? found->next : nullptr; p && !mayHaveMore; p = p->next) {
+				mayHaveMore = p->address == address;
+			}
+			callback(found != nullptr, mayHaveMore);
+
+			if (found) {
+				found->unparked = true;
+				found->wakeUp.notify_one(); //Notified with the bucket locked: once unparked is set, the parked thread may return and destroy found as soon as it can lock the bucket.
+			}
+		}
+
+		//Unparks all of the threads parked on address.
+		static void unparkAll(const void* address) {
+			Bucket& bucket = bucketOf(address);
+			std::lock_guard guard{bucket.mtx};
+			Parked* previous = nullptr;
+			for (Parked* p = bucket.first; p;) {
+				Parked* next = p->next;
+				if (p->address == address) {
+					unlink(bucket, previous, p);
+					p->unparked = true;
+					p->wakeUp.notify_one();
+				} else {
+					previous = p;
+				}
+				p = next;
+			}
+		}
+	};
+
+	class CompactLock;
+
+	//The parking lot of the threads waiting for a CompactLock.
+	using ParkingLot = BasicParkingLot<CompactLock>;
+
+	/**
+	 * @class CompactLock
+	 * @brief One-byte lock, for ThreadSafe objects so small and so many that a std::mutex (40 bytes on Linux) would dominate their memory footprint: `ThreadSafe<int, CompactLock>` takes 8 bytes.
+	 * @details The byte holds a locked bit and a parked bit, set while some thread may be parked in the ParkingLot waiting for the lock. Locking and unlocking an uncontended lock is a single compare-and-swap; a contending thread spins for a short while, then parks.
+	 * unlock wakes up one parked thread, which competes for the lock again with the running ones (it is not handed the lock over), so that a lock released and retaken by the same thread does not cost a context switch.
+	**/
+	class CompactLock {
+		static constexpr std::uint8_t lockedBit = 1;
+		static constexpr std::uint8_t parkedBit = 2;
+		static constexpr unsigned spinLimit = 40; //How many times a contending thread checks the lock before parking.
+
+		std::atomic<std::uint8_t> state{0};
+
+		void lockSlow() {
+			unsigned spins = 0;
+			for (;;) {
+				std::uint8_t s = state.load(std::memory_order_relaxed);
+				if (!(s & lockedBit)) {
+					if (state.compare_exchange_weak(s, s | lockedBit, std::memory_order_acquire, std::memory_order_relaxed)) {
+						return;
+					}
+					continue;
+				}
+				if (!(s & parkedBit)) {
+					if (spins < spinLimit) {
+						++spins;
+						cpuRelax();
+						continue;
+					}
+					if (!state.compare_exchange_weak(s, s | parkedBit, std::memory_order_relaxed)) {
+						continue;
+					}
+				}
+				ParkingLot::park(this, [this]() { return state.load(std::memory_order_relaxed) == (lockedBit | parkedBit); });
+			}
+		}
+
+		void unlockSlow() {
+			ParkingLot::unparkOne(this, [this](bool, bool mayHaveMore) {
+				state.store(mayHaveMore ? parkedBit : 0, std::memory_order_release);
+			});
+		}
+
+		public:
+		CompactLock() = default;
+		CompactLock(const CompactLock&) = delete;
+		CompactLock& operator=(const CompactLock&) = delete;
+
+		void lock() {
+			std::uint8_t expected = 0;
+			if (!state.compare_exchange_weak(expected, lockedBit, std::memory_order_acquire, std::memory_order_relaxed)) {
+				lockSlow();
+			}
+		}
+
+		bool try_lock() {
+			std::uint8_t s = state.load(std::memory_order_relaxed);
+			while (!(s & lockedBit)) {
+				if (state.compare_exchange_weak(s, s | lockedBit, std::memory_order_acquire, std::memory_order_relaxed)) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void unlock() {
+			std::uint8_t expected = lockedBit;
+			if (!state.compare_exchange_strong(expected, 0, std::memory_order_release, std::memory_order_relaxed)) {
+				unlockSlow();
+			}
+		}
+	};
+
+}
+
+#endif
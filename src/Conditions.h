@@ -0,0 +1,94 @@
+#ifndef THREAD_SAFE_CONDITIONS
+#define THREAD_SAFE_CONDITIONS
+
+#include <array>
+#include <cstddef>
+#include "CompactLock.h"
+
+//Waiting for a ThreadSafe object to satisfy a predicate (see ThreadSafe::wait_until): the waiting threads are parked in a global table, and the writers wake them up when they release the object.
+namespace thread_safe {
+
+	struct ConditionParking; //Tag of the parking lot of the threads waiting for a change of an object.
+
+	//The parking lot of the threads waiting for a change of a ThreadSafe object. They are parked on the address of the internal lock of the object.
+	using ConditionLot = BasicParkingLot<ConditionParking>;
+
+	/**
+	 * @class NotifyBatch
+	 * @brief While an object of this class exists, the notifications of the objects released by the current thread are deferred, and sent once per object when the outermost batch is destroyed.
+	 * @details A producer pushing many elements one at a time would otherwise wake up the consumers at each push, and they would immediately contend for the lock it takes again:
+	 * @code
+	 * {
+	 *     thread_safe::NotifyBatch batch;
+	 *     for (Job& job : jobs) {
+	 *         queue->push_back(std::move(job));
+	 *     }
+	 * } //the consumers waiting on queue are woken up here, once
+	 * @endcode
+	 * Up to capacity different objects are deferred, the notifications of the other ones are sent at once.
+	**/
+	class NotifyBatch {
+		static constexpr std::size_t capacity = 16;
+
+		struct Pending {
+			std::array<const void*, capacity> addresses{};
+			std::size_t count = 0;
+			std::size_t depth = 0; //How many batches of the thread are alive.
+		};
+
+		static Pending& local() {
+			thread_local Pending pending;
+			return pending;
+		}
+
+		public:
+		NotifyBatch() {
+			++local().depth;
+		}
+
+		NotifyBatch(const NotifyBatch&) = delete;
+		NotifyBatch& operator=(const NotifyBatch&) = delete;
+
+		~NotifyBatch() {
+			Pending& pending = local();
+			if (--pending.depth == 0) {
+				for (std::size_t i = 0; i < pending.count; ++i) {
+					ConditionLot::unparkAll(pending.addresses[i]);
+				}
+				pending.count = 0;
+			}
+		}
+
+		//Records the notification of the object locked by address, if a batch is alive on the current thread. Returns whether it has been deferred.
+		static bool defer(const void* address) {
+			Pending& pending = local();
+			if (pending.depth == 0) {
+				return false;
+			}
+			for (std::size_t i = 0; i < pending.count; ++i) {
+				if (pending.addresses[i] == address) {
+					return true;
+				}
+			}
+			if (pending.count == capacity) {
+				return false;
+			}
+			pending.addresses[pending.count++] = address;
+			return true;
+		}
+	};
+
+	/**
+	 * @brief Wakes up the threads waiting for a change of the object whose internal lock is at address, or defers it to the NotifyBatch of the current thread.
+	 * @details It must be called after the change has been made visible: either after releasing the lock of the object, or after a sequentially consistent write. If no thread is waiting it costs a load.
+	 * @param address The address of the internal lock of the changed object.
+	**/
+	inline void notifyWaiters(const void* address) {
+		if (ConditionLot::mayHaveParked(address) && !NotifyBatch::defer(address)) {
+			ConditionLot::unparkAll(address);
+		}
+	}
+
+}
+
+#endif
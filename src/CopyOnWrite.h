@@ -0,0 +1,359 @@
+#ifndef THREAD_SAFE_COPY_ON_WRITE
+#define THREAD_SAFE_COPY_ON_WRITE
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <type_traits>
+#include "ThreadSafe.h"
+
+//Copy-on-write mode of ThreadSafe, meant for big objects which are read very often and modified rarely (routing tables, configuration maps...).
+namespace thread_safe {
+
+	//Lock policy selecting the copy-on-write mode of ThreadSafe. The lock itself only serializes the writers: readers never lock.
+	template<Lockable WriterLock = std::mutex>
+	struct BasicCopyOnWrite : WriterLock {};
+
+	using CopyOnWrite = BasicCopyOnWrite<>;
+
+	//Copy-on-write objects cannot be part of a comma separated list, since they cannot be modified in place.
+	template<typename WrappedType, Lockable WriterLock>
+	struct IsThreadSafe<ThreadSafe<WrappedType, BasicCopyOnWrite<WriterLock>>> : std::false_type {};
+
+	/**
+	 * @class HazardPointers
+	 * @brief One hazard pointer per thread, used to protect a published version while its reference count is incremented.
+	 * @details A reader publishes the pointer it is about to use, then checks that it is still the current one: from then on no writer can free it. The records are kept in a lock-free list which only grows (a record is reused when its thread exits).
+	**/
+	class HazardPointers {
+		struct Record {
+			std::atomic<const void*> pointer{nullptr};
+			std::atomic<bool> active{true};
+			Record* next = nullptr;
+		};
+
+		static std::atomic<Record*>& head() {
+			static std::atomic<Record*> first{nullptr};
+			return first;
+		}
+
+		//Reuses the record of a thread which exited or, if there is none, appends a new record to the list.
+		static Record* acquireRecord() {
+			for (Record* r = head().load(); r; r = r->next) {
+				bool expected = false;
+				if (!r->active.load(std::memory_order_relaxed) && r->active.compare_exchange_strong(expected, true)) {
+					return r;
+				}
+			}
+			Record* created = new Record;
+			created->next = head().load();
+			while (!head().compare_exchange_weak(created->next, created));
+			return created;
+		}
+
+		//Owns the record of a thread for the whole life of the thread.
+		struct Owner {
+			Record* record = acquireRecord();
+
+			~Owner() {
+				record->pointer.store(nullptr);
+				record->active.store(false);
+			}
+		};
+
+		public:
+		//Returns the hazard pointer of the calling thread.
+		static std::atomic<const void*>& local() {
+			thread_local Owner owner;
+			return owner.record->pointer;
+		}
+
+		//Returns whether some thread is protecting p with its hazard pointer.
+		static bool isProtected(const void* p) {
+			for (Record* r = head().load(); r; r = r->next) {
+				if (r->pointer.load() == p) {
+					return true;
+				}
+			}
+			return false;
+		}
+	};
+
+	//A version of a copy-on-write object. readers counts the Snapshot objects referring to it, plus one for the object itself while the version is the current one, so it only drops to 0 once the version has been retired.
+	template<typename WrappedType>
+	struct Version {
+		WrappedType value;
+		std::atomic<std::size_t> readers{1};
+		Version* nextRetired = nullptr; //The next version in the list of the versions waiting to be reclaimed.
+		void (*released)(void* owner) = nullptr; //Called with owner by the Snapshot dropping readers to 0, to reclaim the version.
+		void* owner = nullptr;
+
+		template<typename ...ArgsType>
+		Version(ArgsType&&... args) : value(std::forward<ArgsType>(args)...) {}
+	};
+
+	/**
+	 * @class Snapshot
+	 * @brief Read-only handle to an immutable version of a copy-on-write ThreadSafe object.
+	 * @details As long as the handle exists the version it refers to is not reclaimed, even if writers publish newer versions: the last handle to a replaced version reclaims it when destroyed. A Snapshot must not outlive the ThreadSafe object it comes from.
+	 * Moving a handle does not touch the reference count; a moved-from handle must only be destroyed.
+	**/
+	template<typename WrappedType>
+	class Snapshot {
+		Version<WrappedType>* version; //The version this handle refers to (already counted in its readers).
+
+		public:
+		explicit Snapshot(Version<WrappedType>* version) : version{version} {}
+
+		Snapshot(const Snapshot& other) : version{other.version} {
+			version->readers.fetch_add(1, std::memory_order_relaxed); //The version is already kept alive by other.
+		}
+
+		Snapshot(Snapshot&& other) noexcept : version{std::exchange(other.version, nullptr)} {}
+
+		Snapshot& operator=(const Snapshot&) = delete;
+
+		//The version may be reclaimed as soon as readers drops, so what is needed afterwards is read before.
+		~Snapshot() {
+			if (!version) {
+				return;
+			}
+			auto released = version->released;
+			void* owner = version->owner;
+			if (version->readers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				released(owner);
+			}
+		}
+
+		const WrappedType* operator->() const {
+			return &version->value;
+		}
+
+		const WrappedType& operator*() const {
+			return version->value;
+		}
+
+		operator const WrappedType&() const {
+			return version->value;
+		}
+	};
+
+	/**
+	 * @class ThreadSafe<WrappedType, BasicCopyOnWrite<WriterLock>>
+	 * @brief Copy-on-write (read-copy-update) mode of ThreadSafe: readers get an immutable snapshot without locking, writers publish a modified copy.
+	 * @details `*` and `->` return a Snapshot of the current version, taking no lock: a reader only writes its own hazard pointer and the reference count of the version.
+	 * `update(fn)` replaces `->` for mutations: under WriterLock it copies the current version, applies fn to the copy and atomically publishes it. A replaced version is reclaimed as soon as no reader refers to it: by the update itself, or by the destruction of its last Snapshot. That reader only tries WriterLock: if a writer holds it, the writer reclaims the version once it releases it.
+	 * wait_until gives a reader the first version satisfying a predicate: each update wakes up the waiting readers.
+	 * @tparam WrappedType The type of the protected object. It must be copy constructible.
+	 * @tparam WriterLock The lock serializing the writers.
+	**/
+	template<typename WrappedType, Lockable WriterLock>
+	class ThreadSafe<WrappedType, BasicCopyOnWrite<WriterLock>> {
+		std::atomic<Version<WrappedType>*> current; //The version new readers get.
+		WriterLock writers; //Serializes the writers.
+		Version<WrappedType>* retired = nullptr; //The versions replaced by a writer, which may still have readers. Guarded by writers.
+		std::atomic<bool> released{false}; //Whether a retired version may have no readers left, but has not been reclaimed yet.
+
+		//Creates a version which, once its last Snapshot is destroyed, is reclaimed by this object.
+		template<typename ...ArgsType>
+		Version<WrappedType>* makeVersion(ArgsType&&... args) {
+			auto* v = new Version<WrappedType>(std::forward<ArgsType>(args)...);
+			v->released = &ThreadSafe::reclaimReleased;
+			v->owner = this;
+			return v;
+		}
+
+		//Reclaims the retired versions if WriterLock is free. Otherwise its holder does it, after releasing it, since released is set: whoever takes the lock last sees the flag. The holder may be the current thread (a Snapshot destroyed inside update), which is recorded in HeldLocks.
+		static void reclaimReleased(void* owner) {
+			ThreadSafe& self = *static_cast<ThreadSafe*>(owner);
+			self.released.store(true);
+			if (HeldLocks::reenters(&self.writers, true)) {
+				return;
+			}
+			while (self.released.load() && self.writers.try_lock()) {
+				self.released.store(false);
+				bool done = self.reclaim();
+				self.writers.unlock();
+				if (!done) {
+					self.released.store(true); //Retried by the next reader, once the hazard pointer has moved on.
+					return;
+				}
+			}
+		}
+
+		//Deletes the retired versions which are neither referred by a Snapshot nor about to be (protected by a hazard pointer). Must be called with writers locked. Returns false if a version without readers has been kept only because of a hazard pointer.
+		bool reclaim() {
+			bool done = true;
+			Version<WrappedType>** link = &retired;
+			while (Version<WrappedType>* v = *link) {
+				if (v->readers.load(std::memory_order_acquire) != 0) {
+					link = &v->nextRetired;
+				} else if (HazardPointers::isProtected(v)) {
+					done = false;
+					link = &v->nextRetired;
+				} else {
+					*link = v->nextRetired;
+					delete v;
+				}
+			}
+			return done;
+		}
+
+		//Replaces the current version with the new one and retires the old one, dropping the reference the object held to it. Must be called with writers locked.
+		void publish(Version<WrappedType>* next) {
+			Version<WrappedType>* old = current.exchange(next);
+			old->nextRetired = retired;
+			retired = old;
+			old->readers.fetch_sub(1, std::memory_order_release);
+			if (!reclaim()) {
+				released.store(true);
+			}
+		}
+
+		//Returns a Snapshot of the current version: the version is protected with the hazard pointer until its reference count has been incremented.
+		Snapshot<WrappedType> acquire() const {
+			std::atomic<const void*>& hazard = HazardPointers::local();
+			Version<WrappedType>* v = current.load();
+			for (;;) {
+				hazard.store(v);
+				Version<WrappedType>* check = current.load();
+				if (check == v) {
+					break;
+				}
+				v = check;
+			}
+			v->readers.fetch_add(1);
+			hazard.store(nullptr);
+			if (released.load(std::memory_order_relaxed)) {
+				reclaimReleased(const_cast<ThreadSafe*>(this)); //A version may have been kept because of a hazard pointer: this one has moved on.
+			}
+			return Snapshot<WrappedType>{v};
+		}
+
+		public:
+		/**
+		 * @brief Constructs the first version of the object.
+		 * @param args The arguments passed to the constructor of the WrappedType object via perfect forwarding.
+		**/
+		template<typename ...ArgsType>
+		ThreadSafe(ArgsType&&... args) : current{makeVersion(std::forward<ArgsType>(args)...)} {
+			THREAD_SAFE_TRACE(ThreadSafeCtor, this);
+		}
+
+		ThreadSafe(const ThreadSafe&) = delete;
+		ThreadSafe& operator=(const ThreadSafe&) = delete;
+
+		//Deletes all of the versions. No Snapshot of this object can exist anymore.
+		~ThreadSafe() {
+			delete current.load();
+			while (Version<WrappedType>* v = retired) {
+				retired = v->nextRetired;
+				delete v;
+			}
+		}
+
+		/**
+		 * @brief Returns a read-only handle to the current version of the object, without locking.
+		 * @return A Snapshot which keeps the current version alive.
+		**/
+		Snapshot<WrappedType> operator*() const {
+			THREAD_SAFE_TRACE(ThreadSafeConstDereference, this);
+			return acquire();
+		}
+
+		/**
+		 * @brief Reads a member of the current version of the object, without locking.
+		 * @return A Snapshot of the current version, whose `->` operator is chained to access the member.
+		**/
+		Snapshot<WrappedType> operator->() const {
+			THREAD_SAFE_TRACE(ThreadSafeConstArrow, this);
+			return acquire();
+		}
+
+		/**
+		 * @brief Modifies the object by publishing a modified copy of the current version.
+		 * @details The writers are serialized: fn is applied to a private copy of the current version, which then atomically replaces it. Readers which already hold a Snapshot keep seeing the old version. If fn throws, the copy is discarded and nothing is published.
+		 * @tparam Function A callable accepting a WrappedType&.
+		 * @param fn The modification to apply.
+		 * @return The value returned by fn (by value, since the published version must not be modified anymore).
+		**/
+		template<typename Function>
+		auto update(Function&& fn) {
+			THREAD_SAFE_TRACE(ThreadSafeUpdate, this);
+			struct Notify {
+				ThreadSafe& self;
+				~Notify() {
+					notifyWaiters(&self.writers);
+					if (self.released.load()) {
+						reclaimReleased(&self); //A reader released a retired version while this writer held the lock.
+					}
+				}
+			} notify{*this}; //Destroyed after guard: the waiters are woken up once the writers lock has been released.
+			std::lock_guard guard{writers};
+			HoldingLock holding{writers};
+			std::unique_ptr<Version<WrappedType>> copy{makeVersion(current.load(std::memory_order_relaxed)->value)};
+			if constexpr (std::is_void_v<std::invoke_result_t<Function, WrappedType&>>) {
+				std::forward<Function>(fn)(copy->value);
+				publish(copy.release());
+			} else {
+				auto result = std::forward<Function>(fn)(copy->value);
+				publish(copy.release());
+				return result;
+			}
+		}
+
+		/**
+		 * @brief Waits until pred holds for the current version, sleeping (instead of polling) while it does not.
+		 * @tparam Predicate A callable accepting a const WrappedType& and returning whether the wait is over.
+		 * @param pred The condition to wait for.
+		 * @return A Snapshot of the first version seen for which pred holds. Newer versions may have been published since.
+		**/
+		template<std::predicate<const WrappedType&> Predicate>
+		Snapshot<WrappedType> wait_until(Predicate&& pred) const {
+			THREAD_SAFE_TRACE(ThreadSafeWait, this);
+			for (;;) {
+				Snapshot<WrappedType> version = acquire();
+				if (std::invoke(pred, *version)) {
+					return version;
+				}
+				ConditionLot::park(&writers, [this, &pred]() { return !std::invoke(pred, *acquire()); });
+			}
+		}
+
+		/**
+		 * @brief Waits until pred holds for the current version (see wait_until), at most until deadline.
+		 * @return A Snapshot of the version for which pred holds, or an empty optional if deadline expired first.
+		**/
+		template<std::predicate<const WrappedType&> Predicate, typename Clock, typename Duration>
+		std::optional<Snapshot<WrappedType>> wait_until(Predicate&& pred, const std::chrono::time_point<Clock, Duration>& deadline) const {
+			THREAD_SAFE_TRACE(ThreadSafeWait, this);
+			for (;;) {
+				Snapshot<WrappedType> version = acquire();
+				if (std::invoke(pred, *version)) {
+					return version;
+				}
+				if (Clock::now() >= deadline) {
+					return std::nullopt;
+				}
+				ConditionLot::parkUntil(&writers, [this, &pred]() { return !std::invoke(pred, *acquire()); }, deadline);
+			}
+		}
+
+		//Waits until pred holds for the current version (see wait_until), at most for timeout.
+		template<std::predicate<const WrappedType&> Predicate, typename Rep, typename Period>
+		std::optional<Snapshot<WrappedType>> wait_for(Predicate&& pred, const std::chrono::duration<Rep, Period>& timeout) const {
+			return wait_until(std::forward<Predicate>(pred), std::chrono::steady_clock::now() + timeout);
+		}
+	};
+
+	//A ThreadSafe object in copy-on-write mode (see ThreadSafe<WrappedType, BasicCopyOnWrite<WriterLock>>).
+	template<typename WrappedType>
+	using CopyOnWriteThreadSafe = ThreadSafe<WrappedType, CopyOnWrite>;
+
+}
+
+#endif
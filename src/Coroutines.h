@@ -0,0 +1,212 @@
+#ifndef THREAD_SAFE_COROUTINES
+#define THREAD_SAFE_COROUTINES
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <utility>
+#include "LockPolicies.h"
+#include "CompactLock.h"
+#include "HeldLocks.h"
+
+//Locking for coroutines: a lock policy which can be awaited (see ThreadSafe::lock_async), and a minimal scheduler to run coroutines without any external runtime.
+namespace thread_safe {
+
+	//A thread or a coroutine waiting for an AsyncMutex. When the mutex is handed over to it, wake is called.
+	struct LockWaiter {
+		LockWaiter* next = nullptr;
+		void (*wake)(LockWaiter* waiter) = nullptr;
+		std::coroutine_handle<> coroutine; //The waiting coroutine, if the waiter is not a thread.
+	};
+
+	/**
+	 * @class AsyncMutex
+	 * @brief Lock policy which can be acquired by suspending a coroutine instead of blocking its thread.
+	 * @details The state is 0 if the mutex is free, 1 if it is locked, otherwise it is the (last arrived first) list of the waiters arrived while it was locked. unlock hands the mutex over to the oldest waiter, which owns it from then on: a waiting thread is woken up, while a waiting coroutine is resumed on the thread which unlocked the mutex (see resumeHandedOver).
+	 * The mutex is fair (waiters are served in arrival order) and does not allocate: the waiters live on the stack of the waiting threads or in the frames of the waiting coroutines, and are linked through their next field. Threads can lock it as any other mutex, so the same ThreadSafe object can be accessed by threads and coroutines.
+	**/
+	class AsyncMutex {
+		static constexpr std::uintptr_t unlocked = 0;
+		static constexpr std::uintptr_t lockedNoWaiters = 1;
+
+		std::atomic<std::uintptr_t> state{unlocked};
+		LockWaiter* waiters = nullptr; //The waiters in arrival order, moved here from state by unlock. Only accessed by the owner of the mutex.
+
+		public:
+		AsyncMutex() = default;
+		AsyncMutex(const AsyncMutex&) = delete;
+		AsyncMutex& operator=(const AsyncMutex&) = delete;
+
+		bool try_lock() {
+			std::uintptr_t expected = unlocked;
+			return state.compare_exchange_strong(expected, lockedNoWaiters, std::memory_order_acquire, std::memory_order_relaxed);
+		}
+
+		//Locks the mutex if it is free and returns true, otherwise queues waiter and returns false: waiter->wake will be called when the mutex is handed over to it.
+		bool lockOrEnqueue(LockWaiter& waiter) {
+			std::uintptr_t old = state.load(std::memory_order_relaxed);
+			for (;;) {
+				if (old == unlocked) {
+					if (state.compare_exchange_weak(old, lockedNoWaiters, std::memory_order_acquire, std::memory_order_relaxed)) {
+						return true;
+					}
+				} else {
+					waiter.next = old == lockedNoWaiters ? nullptr : reinterpret_cast<LockWaiter*>(old);
+					if (state.compare_exchange_weak(old, reinterpret_cast<std::uintptr_t>(&waiter), std::memory_order_release, std::memory_order_relaxed)) {
+						return false;
+					}
+				}
+			}
+		}
+
+		//A waiting thread parks on the address of its handedOver flag, in the parking lot of the AsyncMutex objects: once the flag is set the thread may return, destroying the waiter, so the thread handing the mutex over only needs the address (not the waiter) to wake it up.
+		void lock() {
+			using Lot = BasicParkingLot<AsyncMutex>;
+			struct ThreadWaiter : LockWaiter {
+				std::atomic<bool> handedOver{false};
+			} waiter;
+			waiter.wake = [](LockWaiter* w) {
+				auto* flag = &static_cast<ThreadWaiter*>(w)->handedOver;
+				flag->store(true, std::memory_order_release); //The last access to the waiter.
+				Lot::unparkOne(flag, [](bool, bool) {});
+			};
+			if (lockOrEnqueue(waiter)) {
+				return;
+			}
+			while (!waiter.handedOver.load(std::memory_order_acquire)) {
+				Lot::park(&waiter.handedOver, [&waiter]() { return !waiter.handedOver.load(std::memory_order_relaxed); });
+			}
+		}
+
+		void unlock() {
+			if (!waiters) {
+				std::uintptr_t old = lockedNoWaiters;
+				if (state.compare_exchange_strong(old, unlocked, std::memory_order_release, std::memory_order_relaxed)) {
+					return;
+				}
+				//Some waiters arrived: they are taken from state (which stays locked) and reversed, so that they are served in arrival order.
+				auto* arrived = reinterpret_cast<LockWaiter*>(state.exchange(lockedNoWaiters, std::memory_order_acquire));
+				while (arrived) {
+					waiters = std::exchange(arrived, std::exchange(arrived->next, waiters));
+				}
+			}
+			LockWaiter* next = std::exchange(waiters, waiters->next);
+			next->wake(next);
+		}
+	};
+
+	//Resumes the coroutine of waiter, which has been handed a mutex over. If another coroutine is being resumed this way by the same thread, waiter is queued and resumed after it returns, so that a chain of hand-overs (each resumed coroutine releasing the mutex to the next waiter) does not grow the stack.
+	//The queue is linked through the next field of the waiters, which is free once the mutex has been handed over, so it does not allocate.
+	//The coroutine is resumed with an empty HeldLocks registry: the thread may still hold other objects (e.g. the rest of the list whose destructor is releasing the mutex), which the coroutine does not hold and must not re-enter. It accesses them as any other thread would, so it should await them with lock_async rather than block on them.
+	inline void resumeHandedOver(LockWaiter& waiter) {
+		struct Queue {
+			LockWaiter* first = nullptr;
+			LockWaiter* last = nullptr;
+			bool resuming = false;
+		};
+		thread_local Queue queue;
+		waiter.next = nullptr;
+		if (queue.resuming) {
+			(queue.last ? queue.last->next : queue.first) = &waiter;
+			queue.last = &waiter;
+			return;
+		}
+
+		struct Resuming {
+			Queue& queue;
+			Resuming(Queue& queue) : queue{queue} { queue.resuming = true; }
+			~Resuming() { queue.resuming = false; }
+		} scope{queue};
+		auto resume = [](std::coroutine_handle<> coroutine) {
+			HeldLocks::Registry none;
+			HeldLocks::Scope isolated{none};
+			coroutine.resume();
+		};
+		resume(waiter.coroutine);
+		while (queue.first) {
+			LockWaiter* next = std::exchange(queue.first, queue.first->next); //Unlinked before resuming it, since the waiter lives in the frame of its coroutine.
+			if (!queue.first) {
+				queue.last = nullptr;
+			}
+			resume(next->coroutine);
+		}
+	}
+
+	//A lock policy which can be awaited by coroutines (see ThreadSafe::lock_async).
+	template<typename LockPolicy>
+	concept AsyncLockable = std::same_as<LockPolicy, AsyncMutex>;
+
+	//An AsyncMutex can be held by a coroutine across suspension points, and released after the coroutine has been resumed on another thread.
+	template<>
+	inline constexpr bool threadOwned<AsyncMutex> = false;
+
+	/**
+	 * @class TestScheduler
+	 * @brief Single-threaded scheduler, to run coroutines using ThreadSafe::lock_async without any external runtime (e.g. in tests).
+	 * @details Coroutines of type TestScheduler::Task are started by spawn and run by run, on the calling thread, until all of them have finished. A coroutine gives the others a chance to run by awaiting yield.
+	 * A coroutine waiting for a lock is not in the ready queue: it is resumed by the coroutine releasing the lock.
+	**/
+	class TestScheduler {
+		std::deque<std::coroutine_handle<>> ready;
+
+		public:
+		//A coroutine started by spawn. It is destroyed when it finishes.
+		class Task {
+			public:
+			struct promise_type {
+				Task get_return_object() {
+					return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+				}
+				std::suspend_always initial_suspend() noexcept { return {}; }
+				std::suspend_never final_suspend() noexcept { return {}; }
+				void return_void() {}
+				void unhandled_exception() { std::terminate(); }
+			};
+
+			Task(Task&& other) noexcept : handle{std::exchange(other.handle, nullptr)} {}
+			Task& operator=(Task&&) = delete;
+
+			~Task() {
+				if (handle) {
+					handle.destroy();
+				}
+			}
+
+			private:
+			friend class TestScheduler;
+			std::coroutine_handle<promise_type> handle;
+
+			explicit Task(std::coroutine_handle<promise_type> handle) : handle{handle} {}
+		};
+
+		//Queues task, which will start running in run.
+		void spawn(Task task) {
+			ready.push_back(std::exchange(task.handle, nullptr));
+		}
+
+		//Awaitable moving the calling coroutine to the back of the ready queue.
+		auto yield() {
+			struct Awaiter {
+				TestScheduler& scheduler;
+				bool await_ready() const noexcept { return false; }
+				void await_suspend(std::coroutine_handle<> handle) { scheduler.ready.push_back(handle); }
+				void await_resume() const noexcept {}
+			};
+			return Awaiter{*this};
+		}
+
+		//Runs the ready coroutines until there are none left.
+		void run() {
+			while (!ready.empty()) {
+				std::coroutine_handle<> next = ready.front();
+				ready.pop_front();
+				next.resume();
+			}
+		}
+	};
+
+}
+
+#endif
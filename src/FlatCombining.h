@@ -0,0 +1,206 @@
+#ifndef THREAD_SAFE_FLAT_COMBINING
+#define THREAD_SAFE_FLAT_COMBINING
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include "LockPolicies.h"
+#include "HeldLocks.h"
+#include "Conditions.h"
+
+//Flat combining lock policy, for objects accessed by many threads at the same time: instead of handing the lock over from thread to thread, the thread holding it runs the operations of all of the waiting threads.
+namespace thread_safe {
+
+	//An operation waiting to be run by the combiner. It lives on the stack of the thread which published it, which waits until done is set.
+	struct CombiningRequest {
+		void (*run)(CombiningRequest* request, void* object) = nullptr; //Runs the operation on object and stores its result in the request.
+		CombiningRequest* next = nullptr; //The next request in the list of the pending ones.
+		std::exception_ptr error; //The exception thrown by the operation, rethrown to the thread which published it.
+		HeldLocks::Registry* heldLocks = nullptr; //The locks held by the thread which published the request, which waits without touching them until done is set.
+		std::atomic<bool> done{false};
+	};
+
+	/**
+	 * @class BasicFlatCombining
+	 * @brief Lock policy which makes ThreadSafe::apply combine the operations of the threads contending for the object.
+	 * @details A thread calling apply publishes its operation in a request on its own stack, pushed on a lock-free list, then waits for the request to be done. While waiting it keeps trying the lock: the thread which gets it becomes the combiner, and runs all of the pending operations (its own included) before releasing it. If the lock is free when apply is called, the operation is run at once.
+ * A waiting thread spins, then yields, then parks on the address of the lock (see ConditionLot), so that threads waiting while the object is held for a long time (e.g. by a Temp object) do not burn a core each. Combiners wake them up after releasing the lock, as do read-write accesses (see notifyWaiters); a parked thread also wakes up by itself every parkTimeout, in case the lock has been released without notifying (e.g. by a read-only access).
+	 * This way the lock and the protected object stay in the cache of the combiner, instead of bouncing between the cores of all of the contending threads.
+	 * The other accesses (`->`, `*`, comma separated lists) simply lock WriterLock, which is also the lock combiners take.
+	 * The combiner records the lock in HeldLocks, and runs the operation of each thread with the HeldLocks registry of that thread: an operation can access the object again (and the objects its thread holds, since that thread is waiting for it) as if it were run by its own thread, instead of deadlocking.
+	 * @tparam WriterLock The lock protecting the object.
+	**/
+	template<Lockable WriterLock = std::mutex>
+	class BasicFlatCombining : public WriterLock {
+		static constexpr int maxRounds = 4; //How many times the combiner collects the pending requests before releasing the lock.
+		static constexpr unsigned yieldThreshold = 64; //How many times a waiting thread checks its request before starting to yield.
+		static constexpr unsigned parkThreshold = 128; //How many times a waiting thread checks its request before starting to park.
+		static constexpr std::chrono::milliseconds parkTimeout{1}; //How long a parked thread waits before checking the lock again by itself.
+
+		std::atomic<CombiningRequest*> pending{nullptr}; //The requests published and not yet collected by a combiner, the last published first.
+
+		//Request running fn and keeping its result, which is returned by value since the object is not protected anymore once the request is done.
+		template<typename Object, typename Function>
+		struct Request : CombiningRequest {
+			using Result = std::decay_t<std::invoke_result_t<Function&, Object&>>;
+
+			Function& fn;
+			std::optional<std::conditional_t<std::is_void_v<Result>, char, Result>> result;
+
+			explicit Request(Function& fn) : fn{fn} {
+				run = &Request::execute;
+			}
+
+			static void execute(CombiningRequest* request, void* object) {
+				Request* self = static_cast<Request*>(request);
+				if constexpr (std::is_void_v<Result>) {
+					std::invoke(self->fn, *static_cast<Object*>(object));
+				} else {
+					self->result.emplace(std::invoke(self->fn, *static_cast<Object*>(object)));
+				}
+			}
+		};
+
+		void publish(CombiningRequest& request) {
+			request.next = pending.load(std::memory_order_relaxed);
+			while (!pending.compare_exchange_weak(request.next, &request, std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		//Runs the pending requests on object, in the order they have been published, each one with the locks of its thread and lock (which must be held) recorded in HeldLocks.
+		template<typename Lock>
+		void combineOn(const Lock& lock, void* object) {
+			for (int round = 0; round < maxRounds; ++round) {
+				CombiningRequest* batch = pending.exchange(nullptr, std::memory_order_acquire);
+				if (!batch) {
+					return;
+				}
+
+				CombiningRequest* ordered = nullptr;
+				while (batch) {
+					ordered = std::exchange(batch, std::exchange(batch->next, ordered));
+				}
+
+				while (ordered) {
+					CombiningRequest* next = ordered->next; //Read before setting done, since from then on the request may not exist anymore.
+					try {
+						HeldLocks::Scope submitter{*ordered->heldLocks};
+						HoldingLock holding{lock};
+						ordered->run(ordered, object);
+					} catch (...) {
+						ordered->error = std::current_exception();
+					}
+					ordered->done.store(true, std::memory_order_release);
+					ordered = next;
+				}
+			}
+		}
+
+		//Wakes up the threads parked on lock, once their requests are done or lock has been released. Notified directly rather than through notifyWaiters, since a NotifyBatch of the combiner would keep them parked until it ends.
+		static void wakeParked(const void* lock) {
+			std::atomic_thread_fence(std::memory_order_seq_cst); //Orders the stores to done and the release of lock before the check of the parked threads.
+			if (ConditionLot::mayHaveParked(lock)) {
+				ConditionLot::unparkAll(lock);
+			}
+		}
+
+		//Calls wakeParked when it goes out of scope (after the guard of the lock, if declared before it), even if the operation throws.
+		struct WakeParked {
+			const void* lock;
+
+			~WakeParked() {
+				wakeParked(lock);
+			}
+		};
+
+		public:
+		/**
+		 * @brief Runs fn on object, possibly combined with the operations of other threads.
+		 * @param lock The lock to take in order to become the combiner: it is this policy, possibly wrapped (e.g. by InstrumentedLock).
+		 * @param object The protected object.
+		 * @param fn The operation to run.
+		 * @return The value returned by fn (by value).
+		**/
+		template<Lockable Lock, typename Object, typename Function>
+		auto combine(Lock& lock, Object& object, Function& fn) {
+			using Result = typename Request<Object, Function>::Result;
+
+			//Uncontended fast path: the operation is run directly, then the requests published in the meanwhile are served.
+			if (lock.try_lock()) {
+				WakeParked wake{&lock};
+				std::unique_lock guard{lock, std::adopt_lock};
+				if constexpr (std::is_void_v<Result>) {
+					{
+						HoldingLock holding{lock};
+						std::invoke(fn, object);
+					}
+					combineOn(lock, &object);
+					return;
+				} else {
+					std::optional<Result> result;
+					{
+						HoldingLock holding{lock};
+						result.emplace(std::invoke(fn, object));
+					}
+					combineOn(lock, &object);
+					return std::move(*result);
+				}
+			}
+
+			Request<Object, Function> request{fn};
+			request.heldLocks = &HeldLocks::local();
+			publish(request);
+			for (unsigned checks = 0; !request.done.load(std::memory_order_acquire); ++checks) {
+				bool locked = lock.try_lock();
+				if (!locked) {
+					if (checks < yieldThreshold) {
+						cpuRelax();
+					} else if (checks < parkThreshold) {
+						std::this_thread::yield();
+					} else {
+						//The lock is tried again under the lock of the parking lot, so a release notified in the meanwhile cannot be missed.
+						ConditionLot::parkUntil(&lock, [&request, &lock, &locked]() {
+							if (request.done.load(std::memory_order_acquire)) {
+								return false;
+							}
+							locked = lock.try_lock();
+							return !locked;
+						}, std::chrono::steady_clock::now() + parkTimeout);
+					}
+				}
+				if (locked) {
+					WakeParked wake{&lock};
+					std::unique_lock guard{lock, std::adopt_lock};
+					combineOn(lock, &object);
+				}
+			}
+
+			if (request.error) {
+				std::rethrow_exception(request.error);
+			}
+			if constexpr (!std::is_void_v<Result>) {
+				return std::move(*request.result);
+			}
+		}
+	};
+
+	using FlatCombining = BasicFlatCombining<>;
+
+	template<typename LockPolicy>
+	struct IsFlatCombining : std::false_type {};
+
+	template<Lockable WriterLock>
+	struct IsFlatCombining<BasicFlatCombining<WriterLock>> : std::true_type {};
+
+	//A lock policy combining the operations run through ThreadSafe::apply.
+	template<typename LockPolicy>
+	concept FlatCombiningLockable = IsFlatCombining<LockPolicy>::value;
+
+}
+
+#endif
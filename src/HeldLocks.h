@@ -0,0 +1,211 @@
+#ifndef THREAD_SAFE_HELD_LOCKS
+#define THREAD_SAFE_HELD_LOCKS
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "LockPolicies.h"
+
+//THREAD_SAFE_LOCK_ORDER_CHECKS enables the report of lock-order inversions (see lockOrderReporter). It defaults to enabled in debug builds (NDEBUG not defined) and disabled otherwise, in which case neither the checks nor the reporter are compiled.
+#ifndef THREAD_SAFE_LOCK_ORDER_CHECKS
+#ifdef NDEBUG
+#define THREAD_SAFE_LOCK_ORDER_CHECKS 0
+#else
+#define THREAD_SAFE_LOCK_ORDER_CHECKS 1
+#endif
+#endif
+
+#if THREAD_SAFE_LOCK_ORDER_CHECKS
+#include <iostream>
+#endif
+
+//Per-thread registry of the locks held through Temp objects and LocksList objects, which makes the accesses to an object already locked by the same thread re-entrant.
+namespace thread_safe {
+
+	/**
+	 * @brief A lock-order inversion: a thread is about to wait for the mutex acquired while it holds the mutex held, which has a higher address.
+	 * @details Comma separated lists acquire mutexes in address order, so a thread doing the opposite can deadlock with any list containing both objects. If held and acquired are the same mutex, the thread holds it in shared mode and is waiting for it in exclusive mode, which can never succeed.
+	**/
+	struct LockOrderInversion {
+		const void* held;
+		const void* acquired;
+	};
+
+	#if THREAD_SAFE_LOCK_ORDER_CHECKS
+	//Prints inversion to std::cerr.
+	inline void printLockOrderInversion(const LockOrderInversion& inversion) {
+		if (inversion.held == inversion.acquired) {
+			std::cerr << "thread_safe: waiting in exclusive mode for mutex " << inversion.acquired << ", held in shared mode by the same thread\n";
+		} else {
+			std::cerr << "thread_safe: lock-order inversion: waiting for mutex " << inversion.acquired << " while holding mutex " << inversion.held << " (higher address)\n";
+		}
+	}
+
+	//Called for each lock-order inversion detected when THREAD_SAFE_LOCK_ORDER_CHECKS is enabled. It can be replaced, e.g. to abort or to log the inversions elsewhere.
+	inline void (*lockOrderReporter)(const LockOrderInversion&) = &printLockOrderInversion;
+	#endif
+
+	/**
+	 * @class HeldLocks
+	 * @brief The mutexes held by the current thread, each one with the mode (shared or exclusive) it is held in.
+	 * @details Temp objects and LocksList objects record here the mutexes they lock, and check it before locking: a mutex already held by the thread (in exclusive mode, or in shared mode for a read-only access) is not locked again, so the nested access proceeds directly instead of deadlocking.
+	 * The registry stores up to capacity mutexes per thread inline, and the others (e.g. while lockAll holds the shards of a large sharded container) in a vector allocated only when needed, so every held mutex is recorded.
+	 * Only locks released by the thread which acquired them are recorded (see threadOwned): e.g. the AsyncMutex held by a coroutine, which may be resumed on another thread, is not.
+	**/
+	class HeldLocks {
+		static constexpr std::size_t capacity = 32;
+
+		struct Entry {
+			const void* mutex;
+			bool exclusive;
+		};
+
+		public:
+		//The mutexes recorded for a thread (see Scope). Only the first count entries are meaningful.
+		struct Registry {
+			std::array<Entry, capacity> entries;
+			std::vector<Entry> overflow; //The entries beyond capacity.
+			std::size_t count = 0;
+
+			Entry& operator[](std::size_t i) {
+				return i < capacity ? entries[i] : overflow[i - capacity];
+			}
+
+			const Entry& operator[](std::size_t i) const {
+				return i < capacity ? entries[i] : overflow[i - capacity];
+			}
+		};
+
+		private:
+		//The registry used by the current thread: its own one, unless a Scope has replaced it.
+		static Registry*& current() {
+			thread_local Registry own;
+			thread_local Registry* used = &own;
+			return used;
+		}
+
+
+		static const Entry* find(const Registry& registry, const void* mutex) {
+			for (std::size_t i = registry.count; i-- > 0;) {
+				if (registry[i].mutex == mutex) {
+					return &registry[i];
+				}
+			}
+			return nullptr;
+		}
+
+		public:
+		//The registry used by the current thread.
+		static Registry& local() {
+			return *current();
+		}
+
+		/**
+		 * @class Scope
+		 * @brief While it exists, the current thread records and looks up its held mutexes in another registry, then goes back to the previous one.
+		 * @details Code which a thread runs on behalf of someone else must not inherit the mutexes held by the thread: e.g. a coroutine resumed inside the destructor of a Temp object (see resumeHandedOver) runs with an empty registry, as it would on any other thread, while a flat combiner runs the operation of another thread with the registry of that thread (see BasicFlatCombining).
+		**/
+		class Scope {
+			Registry* previous;
+
+			public:
+			explicit Scope(Registry& registry) : previous{std::exchange(current(), &registry)} {
+			}
+
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+			~Scope() {
+				current() = previous;
+			}
+		};
+
+		/**
+		 * @brief Tells whether the current thread can access the object protected by mutex without locking it again.
+		 * @param mutex The mutex about to be locked.
+		 * @param exclusive Whether the access needs mutex in exclusive mode.
+		 * @return True if the thread holds mutex in exclusive mode, or in shared mode and exclusive is false.
+		**/
+		static bool reenters(const void* mutex, bool exclusive) {
+			const Registry& registry = local();
+			if (registry.count == 0) {
+				return false;
+			}
+			const Entry* entry = find(registry, mutex);
+			if (!entry) {
+				return false;
+			}
+			if (entry->exclusive || !exclusive) {
+				return true;
+			}
+			#if THREAD_SAFE_LOCK_ORDER_CHECKS
+			lockOrderReporter(LockOrderInversion{mutex, mutex});
+			#endif
+			return false;
+		}
+
+		//Called before the current thread waits for mutex: it reports (only if THREAD_SAFE_LOCK_ORDER_CHECKS is enabled) the held mutexes with a higher address.
+		static void acquiring([[maybe_unused]] const void* mutex) {
+			#if THREAD_SAFE_LOCK_ORDER_CHECKS
+			const Registry& registry = local();
+			for (std::size_t i = 0; i < registry.count; ++i) {
+				if (reinterpret_cast<std::uintptr_t>(registry[i].mutex) > reinterpret_cast<std::uintptr_t>(mutex)) {
+					lockOrderReporter(LockOrderInversion{registry[i].mutex, mutex});
+				}
+			}
+			#endif
+		}
+
+		//Records that the current thread has locked mutex.
+		static void add(const void* mutex, bool exclusive) {
+			Registry& registry = local();
+			if (registry.count < capacity) {
+				registry.entries[registry.count] = Entry{mutex, exclusive};
+			} else {
+				registry.overflow.push_back(Entry{mutex, exclusive});
+			}
+			++registry.count;
+		}
+
+		//Records that the current thread has released mutex.
+		static void remove(const void* mutex) {
+			Registry& registry = local();
+			for (std::size_t i = registry.count; i-- > 0;) {
+				if (registry[i].mutex == mutex) {
+					registry[i] = registry[--registry.count];
+					if (registry.count >= capacity) {
+						registry.overflow.pop_back();
+					}
+					return;
+				}
+			}
+		}
+	};
+
+	//Records in HeldLocks, while it exists, that the current thread holds lock in exclusive mode: used where a lock is taken directly instead of through a Temp object (e.g. by a flat combiner or an actor worker), so that the code run under it can access the object again.
+	template<typename Lock>
+	class HoldingLock {
+		const Lock& lock;
+
+		public:
+		explicit HoldingLock(const Lock& lock) : lock{lock} {
+			if constexpr (threadOwned<Lock>) {
+				HeldLocks::add(&lock, true);
+			}
+		}
+
+		HoldingLock(const HoldingLock&) = delete;
+		HoldingLock& operator=(const HoldingLock&) = delete;
+
+		~HoldingLock() {
+			if constexpr (threadOwned<Lock>) {
+				HeldLocks::remove(&lock);
+			}
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,413 @@
+#ifndef THREAD_SAFE_LOCK_POLICIES
+#define THREAD_SAFE_LOCK_POLICIES
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <concepts>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+//The lock policies which can be used as second template argument of ThreadSafe. Any type satisfying the Lockable concept (std::mutex, std::shared_mutex, std::recursive_mutex...) is a valid policy, the ones defined here are meant for critical sections too short to be worth a kernel-backed mutex.
+namespace thread_safe {
+
+	//A type which can be used as lock policy of a ThreadSafe object. It mirrors the Lockable named requirement of the standard library.
+	template<typename LockPolicy>
+	concept Lockable = requires(LockPolicy& l) {
+		l.lock();
+		{ l.try_lock() } -> std::convertible_to<bool>;
+		l.unlock();
+	};
+
+	//A lock which can also be locked in shared mode (e.g. std::shared_mutex). ThreadSafe objects guarded by such a lock let many readers in at the same time.
+	template<typename LockPolicy>
+	concept SharedLockable = Lockable<LockPolicy> && requires(LockPolicy& l) {
+		l.lock_shared();
+		{ l.try_lock_shared() } -> std::convertible_to<bool>;
+		l.unlock_shared();
+	};
+
+	//A lock supporting optimistic reads: a reader calls beginRead, copies the protected data without locking, then calls validateRead. If validateRead returns false a writer interfered and the copy must be thrown away.
+	template<typename LockPolicy>
+	concept OptimisticReadLockable = Lockable<LockPolicy> && requires(const LockPolicy& l, std::uint32_t version) {
+		{ l.beginRead() } -> std::same_as<std::uint32_t>;
+		{ l.validateRead(version) } -> std::same_as<bool>;
+	};
+
+	//A lock stamping the data it protects with a version, which changes each time the lock is released from exclusive mode, unless the holder tells it did not write the data through keepVersion (see Versioned and atomically).
+	template<typename LockPolicy>
+	concept VersionedLockable = Lockable<LockPolicy> && requires(const LockPolicy& l, LockPolicy& m) {
+		{ l.version() } -> std::same_as<std::uint64_t>;
+		m.keepVersion();
+	};
+
+	//Hints the processor that the calling thread is busy-waiting, so that the sibling hyper-thread can run and the memory pipeline is not flooded.
+	inline void cpuRelax() {
+		#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+			_mm_pause();
+		#elif defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+		#elif defined(__aarch64__) || defined(__arm__)
+			asm volatile("yield");
+		#else
+			std::this_thread::yield();
+		#endif
+	}
+
+	//The size of a cache line on the supported platforms. Objects written by different threads are aligned to it, so that they do not share a cache line (false sharing). std::hardware_destructive_interference_size is not used because its value may change across compiler flags, which would break the ABI of the headers.
+	inline constexpr std::size_t cacheLineSize = 64;
+
+	/**
+	 * @class CacheAligned
+	 * @brief Lock policy wrapping LockPolicy so that a ThreadSafe object using it starts on a cache line of its own, and its size is a multiple of the cache line.
+	 * @details The internal lock is the first member of a ThreadSafe object, so a small wrapped object shares the cache line of its lock (one cache miss to lock and access it), while the objects next to it in an array or in a struct never share that line (no false sharing).
+	 * The wrapper only forwards the locking interface: the policies recognized by their type (FlatCombining, Actor, AsyncMutex...) lose their extra features when wrapped.
+	 * @tparam LockPolicy The wrapped lock.
+	**/
+	template<Lockable LockPolicy>
+	class CacheAligned : public LockPolicy {
+		public:
+		using LockPolicy::LockPolicy;
+	};
+
+	//The alignment required by LockPolicy for the ThreadSafe objects using it: a cache line for CacheAligned policies, otherwise no requirement beyond the natural alignment of the object.
+	template<typename LockPolicy>
+	inline constexpr std::size_t layoutAlignmentOf = 1;
+
+	template<Lockable LockPolicy>
+	inline constexpr std::size_t layoutAlignmentOf<CacheAligned<LockPolicy>> = cacheLineSize;
+
+	//Whether a lock of type LockPolicy is always released by the thread which acquired it, so that it can be recorded among the locks held by that thread (see HeldLocks).
+	template<typename LockPolicy>
+	inline constexpr bool threadOwned = true;
+
+	/**
+	 * @class SpinLock
+	 * @brief Test-and-test-and-set spinlock with exponential backoff.
+	 * @details While the lock is busy, waiting threads only read it (so the cache line is shared, not bounced between cores), pausing for a time which doubles after each failed attempt, up to maxBackoff pauses.
+	 * Once the backoff is at its maximum, the waiting thread also yields its time slice, so that an owner which has been preempted can run. It never sleeps, so it should only protect critical sections a few nanoseconds long.
+	**/
+	class SpinLock {
+		static constexpr unsigned maxBackoff = 1024; //The maximum number of pauses between 2 attempts.
+		std::atomic<bool> locked{false};
+
+		public:
+		void lock() {
+			for (unsigned backoff = 1; locked.exchange(true, std::memory_order_acquire); backoff = std::min(backoff * 2, maxBackoff)) {
+				while (locked.load(std::memory_order_relaxed)) {
+					for (unsigned i = 0; i < backoff; ++i) {
+						cpuRelax();
+					}
+					if (backoff == maxBackoff) {
+						std::this_thread::yield();
+					}
+				}
+			}
+		}
+
+		bool try_lock() {
+			return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+		}
+
+		void unlock() {
+			locked.store(false, std::memory_order_release);
+		}
+	};
+
+	/**
+	 * @class AdaptiveLock
+	 * @brief Spin-then-park lock: it spins for a while, then it puts the thread to sleep on the lock word (which is a futex on Linux).
+	 * @details The state is 0 if the lock is free, 1 if it is locked, 2 if it is locked and some threads may be sleeping on it. Only the unlock of a lock in state 2 pays for a wake up system call.
+	**/
+	class AdaptiveLock {
+		static constexpr int spinLimit = 100; //How many times the lock is tried before going to sleep.
+		std::atomic<std::uint32_t> state{0};
+
+		public:
+		void lock() {
+			for (int i = 0; i < spinLimit; ++i) {
+				if (try_lock()) {
+					return;
+				}
+				cpuRelax();
+			}
+			while (state.exchange(2, std::memory_order_acquire) != 0) {
+				state.wait(2, std::memory_order_relaxed);
+			}
+		}
+
+		bool try_lock() {
+			std::uint32_t expected = 0;
+			return state.load(std::memory_order_relaxed) == 0 && state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed);
+		}
+
+		void unlock() {
+			if (state.exchange(0, std::memory_order_release) == 2) {
+				state.notify_one();
+			}
+		}
+	};
+
+	/**
+	 * @class TicketLock
+	 * @brief FIFO spinlock: each thread takes a ticket and waits until its number is served.
+	 * @details Unlike SpinLock, threads acquire the lock in arrival order, so no thread can starve. Waiting threads back off proportionally to their distance from the head of the queue.
+	 * After yieldThreshold checks the waiting thread also yields its time slice, because a FIFO hand-off to a thread which is not running would stall the whole queue.
+	**/
+	class TicketLock {
+		static constexpr unsigned yieldThreshold = 64; //How many times the ticket is checked before starting to yield.
+		std::atomic<std::uint32_t> next{0}; //The ticket the next arriving thread will take.
+		std::atomic<std::uint32_t> serving{0}; //The ticket currently owning the lock.
+
+		public:
+		void lock() {
+			std::uint32_t ticket = next.fetch_add(1, std::memory_order_relaxed);
+			std::uint32_t current;
+			for (unsigned checks = 0; (current = serving.load(std::memory_order_acquire)) != ticket; ++checks) {
+				if (checks < yieldThreshold) {
+					for (std::uint32_t i = 0; i < ticket - current; ++i) {
+						cpuRelax();
+					}
+				} else {
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		bool try_lock() {
+			std::uint32_t current = serving.load(std::memory_order_acquire);
+			std::uint32_t expected = current;
+			return next.compare_exchange_strong(expected, current + 1, std::memory_order_acquire, std::memory_order_relaxed);
+		}
+
+		void unlock() {
+			serving.store(serving.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+	};
+
+
+	/**
+	 * @class BasicSeqLock
+	 * @brief Sequence lock: writers are serialized by a WriterLock, readers never write shared memory.
+	 * @details The sequence number is odd while a writer holds the lock. A reader records the (even) sequence number in beginRead, copies the data, then validateRead checks that the number did not change in the meanwhile; otherwise the read is torn and must be retried.
+	 * Since readers copy the data while writers may be modifying it, it is only suitable for trivially copyable data (see ThreadSafe::snapshot). As in every seqlock, such racing copies are reported by ThreadSanitizer even though torn copies are always discarded.
+	 * @tparam WriterLock The lock serializing the writers.
+	**/
+	template<Lockable WriterLock = SpinLock>
+	class BasicSeqLock {
+		WriterLock writers;
+		std::atomic<std::uint32_t> sequence{0};
+
+		//Makes the sequence number odd, before the writer touches the data.
+		void beginWrite() {
+			sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+		}
+
+		public:
+		void lock() {
+			writers.lock();
+			beginWrite();
+		}
+
+		bool try_lock() {
+			if (!writers.try_lock()) {
+				return false;
+			}
+			beginWrite();
+			return true;
+		}
+
+		void unlock() {
+			sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+			writers.unlock();
+		}
+
+		//Waits until no writer holds the lock and returns the current sequence number.
+		std::uint32_t beginRead() const {
+			std::uint32_t version;
+			while ((version = sequence.load(std::memory_order_acquire)) & 1) {
+				cpuRelax();
+			}
+			return version;
+		}
+
+		//Returns whether no writer acquired the lock since the call to beginRead which returned version.
+		bool validateRead(std::uint32_t version) const {
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return sequence.load(std::memory_order_relaxed) == version;
+		}
+	};
+
+	using SeqLock = BasicSeqLock<>;
+
+	/**
+	 * @class Versioned
+	 * @brief Lock policy wrapping LockPolicy with a version stamp, incremented each time the lock is released from exclusive mode (unless the holder called keepVersion), so that the writes to the protected data can be detected afterwards.
+	 * @details It is the policy of the objects updated through `atomically`, which copies them, runs a transaction on the copies without any lock, and writes the results back only if no version changed in the meanwhile.
+	 * Accesses through a const reference lock it in shared mode, which leaves the version unchanged. If LockPolicy has no shared mode, the shared mode of Versioned takes LockPolicy exclusively: const accesses still serialize, but they do not make the transactions reading the same object fail.
+	 * @tparam LockPolicy The wrapped lock.
+	**/
+	template<Lockable LockPolicy = std::mutex>
+	class Versioned : public LockPolicy {
+		std::atomic<std::uint64_t> stamp{0}; //Only written by the holder of the exclusive lock.
+		bool keep = false; //Whether the next exclusive release leaves the stamp unchanged. Only accessed by the holder of the exclusive lock.
+
+		public:
+		using LockPolicy::LockPolicy;
+
+		void unlock() {
+			if (!std::exchange(keep, false)) {
+				stamp.store(stamp.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+			}
+			LockPolicy::unlock();
+		}
+
+		//Tells that the current holder of the exclusive lock has not written the protected data (e.g. an aborted transaction), so that releasing the lock leaves the version unchanged. It must only be called with the lock held in exclusive mode.
+		void keepVersion() {
+			keep = true;
+		}
+
+		void lock_shared() {
+			if constexpr (SharedLockable<LockPolicy>) {
+				LockPolicy::lock_shared();
+			} else {
+				LockPolicy::lock();
+			}
+		}
+
+		bool try_lock_shared() {
+			if constexpr (SharedLockable<LockPolicy>) {
+				return LockPolicy::try_lock_shared();
+			} else {
+				return LockPolicy::try_lock();
+			}
+		}
+
+		void unlock_shared() {
+			if constexpr (SharedLockable<LockPolicy>) {
+				LockPolicy::unlock_shared();
+			} else {
+				LockPolicy::unlock();
+			}
+		}
+
+		//The current version. It is stable while the lock is held (in any mode) by the caller.
+		std::uint64_t version() const {
+			return stamp.load(std::memory_order_acquire);
+		}
+	};
+
+	template<Lockable LockPolicy>
+	inline constexpr bool threadOwned<Versioned<LockPolicy>> = threadOwned<LockPolicy>;
+
+
+	//A type small enough to be packed, together with a lock bit, in a lock-free 64-bit atomic word (see AtomicWord).
+	template<typename T>
+	concept AtomicWordType = std::is_arithmetic_v<T> && sizeof(T) <= sizeof(std::uint32_t) && std::atomic<std::uint64_t>::is_always_lock_free;
+
+	/**
+	 * @class AtomicWord
+	 * @brief Lock policy which also stores the protected value: the value and a lock bit share a single atomic word.
+	 * @details Single operations (load, fetchUpdate) are lock-free compare-and-swap loops on the word, which only wait while the lock bit is set. The lock is only taken when the ThreadSafe object is part of a LocksList: the owner of the lock works on a plain copy of the value (lockedValue), which unlock writes back to the word.
+	 * It is the default policy of ThreadSafe objects wrapping an AtomicWordType (see ThreadSafe<WrappedType, AtomicWord<WrappedType>>).
+	 * @tparam T The type of the stored value.
+	**/
+	template<AtomicWordType T>
+	class AtomicWord {
+		static constexpr std::uint64_t lockedBit = std::uint64_t{1} << 32; //Set while the lock is held. The value is stored in the lower 32 bits.
+		std::atomic<std::uint64_t> word;
+		T shadow{}; //The value while the lock is held. It is only accessed by the owner of the lock.
+
+		static std::uint64_t encode(T value) {
+			std::uint32_t bits = 0;
+			std::memcpy(&bits, &value, sizeof(T));
+			return bits;
+		}
+
+		static T decode(std::uint64_t w) {
+			std::uint32_t bits = static_cast<std::uint32_t>(w);
+			T value;
+			std::memcpy(&value, &bits, sizeof(T));
+			return value;
+		}
+
+		//Waits until the lock is free and returns the word.
+		std::uint64_t loadUnlocked() const {
+			std::uint64_t w;
+			while ((w = word.load(std::memory_order_acquire)) & lockedBit) {
+				word.wait(w, std::memory_order_relaxed);
+			}
+			return w;
+		}
+
+		public:
+		explicit AtomicWord(T value = T{}) : word{encode(value)} {}
+
+		void lock() {
+			std::uint64_t w = loadUnlocked();
+			while (!word.compare_exchange_weak(w, w | lockedBit, std::memory_order_acquire, std::memory_order_relaxed)) {
+				if (w & lockedBit) {
+					w = loadUnlocked();
+				}
+			}
+			shadow = decode(w);
+		}
+
+		bool try_lock() {
+			std::uint64_t w = word.load(std::memory_order_relaxed);
+			if ((w & lockedBit) || !word.compare_exchange_strong(w, w | lockedBit, std::memory_order_acquire, std::memory_order_relaxed)) {
+				return false;
+			}
+			shadow = decode(w);
+			return true;
+		}
+
+		//Writes the value back and releases the lock. The store is sequentially consistent, so that the threads waiting for a change of the value are not missed (see BasicParkingLot::mayHaveParked).
+		void unlock() {
+			word.store(encode(shadow), std::memory_order_seq_cst);
+			word.notify_all();
+		}
+
+		//The value as seen by the owner of the lock. It must only be used while the lock is held.
+		T& lockedValue() {
+			return shadow;
+		}
+
+		//Returns the current value, waiting if the lock is held.
+		T load() const {
+			return decode(loadUnlocked());
+		}
+
+		//Stores the current value in value and returns true, unless the lock is held.
+		bool tryLoad(T& value) const {
+			std::uint64_t w = word.load(std::memory_order_acquire);
+			if (w & lockedBit) {
+				return false;
+			}
+			value = decode(w);
+			return true;
+		}
+
+		//Atomically replaces the value v with fn(v) and returns v. fn may be called more than once, if other threads modify the value in the meanwhile. The update is sequentially consistent, as unlock.
+		template<typename Function>
+		T fetchUpdate(Function&& fn) {
+			std::uint64_t w = loadUnlocked();
+			while (!word.compare_exchange_weak(w, encode(static_cast<T>(fn(decode(w)))), std::memory_order_seq_cst, std::memory_order_relaxed)) {
+				if (w & lockedBit) {
+					w = loadUnlocked();
+				}
+			}
+			return decode(w);
+		}
+	};
+
+}
+
+#endif
@@ -2,12 +2,63 @@
 #include <string>
 #include <functional>
 #include <sstream>
+#include <thread>
+#include <utility>
+#include <chrono>
+#include <mutex>
+#include <map>
+#include <deque>
+#include <unordered_map>
+#include <future>
+#include <memory>
+
+#ifndef TRACE
+#define TRACE 0 //print each operation performed on the ThreadSafe objects
+#endif
+#if TRACE
+#define THREAD_SAFE_TRACER thread_safe::ConsoleTracer
+#endif
 #include "ThreadSafe.h"
+#include "CopyOnWrite.h"
 #include "Testt.h"
 
+//the sections to run: each one can also be enabled from the command line (e.g. -DACTOR=1), as the thread_safe_sample_all CMake target does
+#ifndef SCRATCH
 #define SCRATCH 0
+#endif
+#ifndef BASIC
 #define BASIC 0
+#endif
+#ifndef AUTOCAST
 #define AUTOCAST 1
+#endif
+#ifndef SHARED
+#define SHARED 0
+#endif
+#ifndef COPY_ON_WRITE
+#define COPY_ON_WRITE 0
+#endif
+#ifndef GUARDS
+#define GUARDS 0
+#endif
+#ifndef ACTOR
+#define ACTOR 0
+#endif
+#ifndef COROUTINES
+#define COROUTINES 0
+#endif
+#ifndef REENTRANT
+#define REENTRANT 0
+#endif
+#ifndef CONDITIONS
+#define CONDITIONS 0
+#endif
+#ifndef BENCHMARK
+#define BENCHMARK 0
+#endif
+#ifndef PAUSE_AT_EXIT
+#define PAUSE_AT_EXIT 1 //keep the console open until a key is pressed
+#endif
 
 
 
@@ -47,7 +98,8 @@ void scratch() {
 #if BASIC
 void basic() {
     thread_safe::ThreadSafe<std::string> safe1{"Ciao"};
-    thread_safe::ThreadSafe<std::string>* pSafe1 = &thread_safe::ThreadSafe<std::string>("Pointer");
+    thread_safe::ThreadSafe<std::string> pointed{"Pointer"};
+    thread_safe::ThreadSafe<std::string>* pSafe1 = &pointed;
 
     safe1->append("oooooooooo"); //append something to the protected string
     (~safe1).append(" how are you?"); //append something to the string NOT safely
@@ -80,7 +132,7 @@ void basic() {
 //}
 
 
-void foo(Testt t) {
+void foo(Testt) {
     std::cout << "\nfoo\n";
 }
 
@@ -99,11 +151,392 @@ void autoCast() {
     foo(std::move(bar(tt1)));
 
 
-    //thread_safe::ThreadSafe<Testt> t1;
+    thread_safe::ThreadSafe<Testt> t1;
+
+    int xxx = 9;
+    xxx << *t1; //the wrapped object is passed as an lvalue: neither copied nor moved
+    xxx << std::move(**t1); //moving it must be explicit
+}
+#endif
+
+
+
+#if SHARED
+void shared() {
+    thread_safe::SharedThreadSafe<std::string> config{"config"};
+    thread_safe::ThreadSafe<std::vector<int>> log;
+
+    //const accesses take a shared lock, so the readers below do not serialize
+    std::thread reader1{[&config]() { std::cout << std::as_const(config)->size() << "\n"; }};
+    std::thread reader2{[&config]() { std::string copy = *std::as_const(config); }};
 
-    //int xxx = 9;
-    //xxx << *t1; //always rvalue, bad
-    //xxx << std::move(*t1); //same as before, not good
+    //config is held shared while log is held exclusively for the whole statement
+    (std::as_const(config), log) ->* ((~log).push_back((~config).size()), 0);
+
+    reader1.join();
+    reader2.join();
+}
+#endif
+
+
+
+#if COPY_ON_WRITE
+void copyOnWrite() {
+    thread_safe::CopyOnWriteThreadSafe<std::map<std::string, int>> routes{std::map<std::string, int>{{"a", 1}}};
+
+    //readers never lock: each one gets a snapshot which stays valid (and unchanged) while the writer publishes new versions
+    std::thread reader{[&routes]() {
+        auto snapshot = *routes;
+        std::cout << snapshot->size() << " " << routes->count("b") << "\n";
+    }};
+
+    routes.update([](auto& table) { table["b"] = 2; });
+    reader.join();
+}
+#endif
+
+
+
+#if GUARDS
+void guards() {
+    thread_safe::ThreadSafe<std::string> name{"Lapo"};
+    thread_safe::ThreadSafe<std::vector<int>> ids;
+    thread_safe::SharedThreadSafe<std::string> prefix{"id: "};
+
+    //one lock acquisition for the whole scope, instead of one per statement
+    {
+        auto guard = name.lock();
+        guard->append(" 9");
+        guard->push_back('!');
+        std::cout << *guard << "\n";
+    }
+
+    //several objects locked together (deadlock free, prefix in shared mode), accessed through structured bindings
+    auto [list, text] = thread_safe::lock(ids, std::as_const(prefix));
+    list.push_back(42);
+    std::cout << text << list.back() << "\n";
+
+    //non-blocking accesses: they give up (and hold nothing) if the objects are busy
+    if (auto access = name.access_for(std::chrono::milliseconds{5})) {
+        (*access)->append("?");
+    }
+    //ids is held by this thread through the structured bindings above, so it is re-entered instead of tried
+    if (auto both = thread_safe::try_lock(name, ids)) {
+        std::cout << "name is free, ids is already held by this thread\n";
+    } else {
+        std::cout << "name is busy\n";
+    }
+}
+#endif
+
+
+
+#if ACTOR
+void actor() {
+    thread_safe::ActorThreadSafe<std::vector<std::string>> log;
+    thread_safe::ThreadSafe<int> lines{0};
+
+    //the callers never wait: the operations are queued and run one at a time by the worker pool
+    log.post([](auto& entries) { entries.push_back("started"); });
+    std::future<std::size_t> size = log.async([](auto& entries) { return entries.size(); });
+
+    //multi-object form: the worker locks both objects (as a comma separated list would) before running the operation
+    //the objects are only referenced by the job, so they must outlive it: here the future is waited before they are destroyed
+    std::future<int> counted = thread_safe::async([](auto& entries, int& count) { return count = static_cast<int>(entries.size()); }, log, lines);
+
+    std::cout << size.get() << " entries\n";
+    std::cout << counted.get() << " lines\n";
+}
+#endif
+
+
+
+#if COROUTINES
+thread_safe::TestScheduler::Task appendTwice(thread_safe::TestScheduler& scheduler, thread_safe::AsyncThreadSafe<std::string>& text, char c) {
+    //while the guard is alive the other coroutines awaiting the lock stay suspended, but the thread keeps running them
+    auto access = co_await text.lock_async();
+    access->push_back(c);
+    co_await scheduler.yield();
+    access->push_back(c);
+}
+
+thread_safe::TestScheduler::Task transfer(thread_safe::AsyncThreadSafe<int>& from, thread_safe::AsyncThreadSafe<int>& to) {
+    auto [f, t] = co_await thread_safe::lock_async(from, to);
+    f -= 10;
+    t += 10;
+}
+
+void coroutines() {
+    thread_safe::AsyncThreadSafe<std::string> text;
+    thread_safe::AsyncThreadSafe<int> a{100}, b{0};
+
+    thread_safe::TestScheduler scheduler;
+    scheduler.spawn(appendTwice(scheduler, text, 'x'));
+    scheduler.spawn(appendTwice(scheduler, text, 'y'));
+    scheduler.spawn(transfer(a, b));
+    scheduler.spawn(transfer(b, a));
+    scheduler.run();
+
+    std::cout << ~text << " " << ~a << " " << ~b << "\n"; //xxyy 100 0
+}
+#endif
+
+
+
+#if BENCHMARK
+//Returns the average time (in nanoseconds) taken by a call to op.
+template<typename Op>
+double nsPerOp(Op op, int iterations = 1'000'000) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        op();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+//Returns how many times per second op is called, when each one of the threads calls it iterations times. op receives the index of the thread calling it.
+template<typename Op>
+double opsPerSecond(int threads, Op op, int iterations = 100'000) {
+    std::vector<std::thread> pool;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        pool.emplace_back([&op, t, iterations]() {
+            for (int i = 0; i < iterations; ++i) {
+                op(t);
+            }
+        });
+    }
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return threads * iterations / elapsed.count();
+}
+
+void benchmark() {
+    thread_safe::ThreadSafe<int, std::mutex> a{1}, b{2}, c{3}, d{4};
+    std::mutex m1, m2, m3, m4;
+    int x = 1;
+
+    double list2 = nsPerOp([&]() { (a, b) ->* ++(~a); });
+    double scoped2 = nsPerOp([&]() { std::scoped_lock lock{m1, m2}; ++x; });
+    double list4 = nsPerOp([&]() { (a, b, c, d) ->* ++(~a); });
+    double scoped4 = nsPerOp([&]() { std::scoped_lock lock{m1, m2, m3, m4}; ++x; });
+
+    std::cout << "LocksList<2>: " << list2 << " ns\tstd::scoped_lock (2): " << scoped2 << " ns\n";
+    std::cout << "LocksList<4>: " << list4 << " ns\tstd::scoped_lock (4): " << scoped4 << " ns\n";
+
+    //4 operations on the same object: one Temp object each, or a single guard
+    thread_safe::ThreadSafe<std::vector<int>> v;
+    double temps = nsPerOp([&]() { v->push_back(1); v->push_back(2); v->push_back(3); v->clear(); });
+    double guard = nsPerOp([&]() { auto g = v.lock(); g->push_back(1); g->push_back(2); g->push_back(3); g->clear(); });
+    std::cout << "4 Temp objects: " << temps << " ns\tThreadSafe::lock: " << guard << " ns\n";
+
+    //stress: the eager locking in source order is only safe if every thread uses the same order, while LocksList can also be used with a different order on each thread
+    for (int threads : {1, 2, 4, 8}) {
+        double eager = opsPerSecond(threads, [&](int) { std::lock_guard l1{m1}, l2{m2}, l3{m3}; ++x; });
+        double sameOrder = opsPerSecond(threads, [&](int) { (a, b, c) ->* ++(~a); });
+        double mixedOrder = opsPerSecond(threads, [&](int t) {
+            switch (t % 3) {
+                case 0: (a, b, c) ->* ++(~a); break;
+                case 1: (c, a, b) ->* ++(~a); break;
+                default: (b, c, a) ->* ++(~a); break;
+            }
+        });
+        std::cout << threads << " threads\teager: " << eager << " ops/s\tLocksList: " << sameOrder << " ops/s\tLocksList (mixed orders): " << mixedOrder << " ops/s\n";
+    }
+
+    //lock policies: 4 threads incrementing the same object
+    thread_safe::ThreadSafe<long> withMutex{0L};
+    thread_safe::ThreadSafe<long, thread_safe::SpinLock> withSpinLock{0L};
+    thread_safe::ThreadSafe<long, thread_safe::AdaptiveLock> withAdaptiveLock{0L};
+    thread_safe::ThreadSafe<long, thread_safe::TicketLock> withTicketLock{0L};
+    auto increment = [](auto& ts) { return opsPerSecond(4, [&ts](int) { *ts ->* ++(~ts); }); };
+    double mutexOps = increment(withMutex), spinOps = increment(withSpinLock), adaptiveOps = increment(withAdaptiveLock), ticketOps = increment(withTicketLock);
+    std::cout << "std::mutex: " << mutexOps << " ops/s\tSpinLock: " << spinOps << " ops/s\tAdaptiveLock: " << adaptiveOps << " ops/s\tTicketLock: " << ticketOps << " ops/s\n";
+
+    //atomic fast path: ThreadSafe<int> is lock-free by default, ThreadSafe<int, std::mutex> locks and builds a Temp object for each increment
+    thread_safe::ThreadSafe<int> atomicCounter{0};
+    thread_safe::ThreadSafe<int, std::mutex> mutexCounter{0};
+    double atomicOps = opsPerSecond(4, [&atomicCounter](int) { ++atomicCounter; });
+    double lockedOps = opsPerSecond(4, [&mutexCounter](int) { *mutexCounter ->* ++(~mutexCounter); });
+    std::cout << "ThreadSafe<int>: " << atomicOps << " ops/s\tThreadSafe<int, std::mutex>: " << lockedOps << " ops/s\n";
+
+    //flat combining: many threads updating the same map, through Temp objects (each thread locks in turn) or through apply (the thread holding the lock runs the waiting updates)
+    for (int threads : {1, 2, 4, 8, 16, 32, 64}) {
+        thread_safe::ThreadSafe<std::map<int, int>> locked;
+        thread_safe::FlatCombiningThreadSafe<std::map<int, int>> combined;
+        double tempOps = opsPerSecond(threads, [&locked](int t) { ++locked->operator[](t); }, 20'000);
+        double applyOps = opsPerSecond(threads, [&combined](int t) { combined.apply([t](auto& map) { ++map[t]; }); }, 20'000);
+        std::cout << threads << " threads\tTemp: " << tempOps << " ops/s\tFlatCombining apply: " << applyOps << " ops/s\n";
+    }
+
+    //key-value cache: 9 lookups every update, on 10000 keys, with a single lock or with a lock per shard
+    for (int threads : {1, 2, 4, 8}) {
+        thread_safe::ThreadSafe<std::unordered_map<int, int>> single;
+        thread_safe::ThreadSafeShardedMap<int, int, 64> sharded;
+        double singleOps = opsPerSecond(threads, [&single](int t) {
+            thread_local unsigned i = 0;
+            int key = static_cast<int>((++i * 7919 + t) % 10'000);
+            if (i % 10 == 0) {
+                ++single->operator[](key);
+            } else {
+                [[maybe_unused]] volatile bool found = single->contains(key);
+            }
+        });
+        double shardedOps = opsPerSecond(threads, [&sharded](int t) {
+            thread_local unsigned i = 0;
+            int key = static_cast<int>((++i * 7919 + t) % 10'000);
+            if (i % 10 == 0) {
+                sharded.update(key, [](int& v) { ++v; });
+            } else {
+                [[maybe_unused]] volatile bool found = sharded.contains(key);
+            }
+        });
+        std::cout << threads << " threads\tThreadSafe<unordered_map>: " << singleOps << " ops/s\tThreadSafeShardedMap (64 shards): " << shardedOps << " ops/s\n";
+    }
+
+    //compact records: 1M small objects, each one with a std::mutex or with a one-byte CompactLock, incremented at scattered positions by 4 threads
+    constexpr int records = 1'000'000;
+    auto withMutexes = std::make_unique<thread_safe::ThreadSafe<int, std::mutex>[]>(records);
+    auto withCompactLocks = std::make_unique<thread_safe::CompactThreadSafe<int>[]>(records);
+    auto scattered = [](int t) {
+        thread_local unsigned i = 0;
+        return static_cast<int>((++i * 2654435761u + t) % records);
+    };
+    double mutexRecordOps = opsPerSecond(4, [&](int t) { auto& r = withMutexes[scattered(t)]; *r ->* ++(~r); }, 1'000'000);
+    double compactRecordOps = opsPerSecond(4, [&](int t) { auto& r = withCompactLocks[scattered(t)]; *r ->* ++(~r); }, 1'000'000);
+    std::cout << "ThreadSafe<int, std::mutex>: " << sizeof(withMutexes[0]) * records / (1 << 20) << " MiB, " << mutexRecordOps << " ops/s\t"
+              << "CompactThreadSafe<int>: " << sizeof(withCompactLocks[0]) * records / (1 << 20) << " MiB, " << compactRecordOps << " ops/s\n";
+
+    //false sharing: each thread increments its own object, packed next to the others or aligned to its own cache line
+    thread_safe::ThreadSafe<long, thread_safe::SpinLock> packed[4];
+    thread_safe::ThreadSafe<long, thread_safe::CacheAligned<thread_safe::SpinLock>> aligned[4];
+    double packedOps = opsPerSecond(4, [&packed](int t) { *packed[t] ->* ++(~packed[t]); }, 1'000'000);
+    double alignedOps = opsPerSecond(4, [&aligned](int t) { *aligned[t] ->* ++(~aligned[t]); }, 1'000'000);
+    std::cout << "packed: " << packedOps << " ops/s\tCacheAligned: " << alignedOps << " ops/s\n";
+
+    //bulk walk of 1M elements: one lock per element through apply, or one lock per stripe of 64 elements through for_each_locked
+    thread_safe::ThreadSafeArray<int> elements(records);
+    thread_safe::ThreadSafeArray<int, std::dynamic_extent, 64> striped(records);
+    double applyWalk = nsPerOp([&elements]() { for (std::size_t i = 0; i < elements.size(); ++i) elements.apply(i, [](int& v) { ++v; }); }, 10);
+    double stripedWalk = nsPerOp([&striped]() { striped.for_each_locked([](int& v) { ++v; }); }, 10);
+    std::cout << "apply on each element: " << applyWalk / 1e6 << " ms\tfor_each_locked (64 elements per stripe): " << stripedWalk / 1e6 << " ms\n";
+
+    //producer/consumer pipeline: 2 producers and 2 consumers passing ints through a mutex-wrapped deque, a ThreadSafeQueue, or a ThreadSafeQueue in batches of 16
+    thread_safe::ThreadSafe<std::deque<int>> deque;
+    thread_safe::ThreadSafeQueue<int> ring{1024};
+    double dequeOps = opsPerSecond(4, [&deque](int t) {
+        if (t % 2 == 0) {
+            deque->push_back(t);
+        } else {
+            auto q = deque.wait_until([](const auto& q) { return !q.empty(); });
+            q->pop_front();
+        }
+    });
+    double ringOps = opsPerSecond(4, [&ring](int t) {
+        if (t % 2 == 0) {
+            ring.push(t);
+        } else {
+            ring.pop();
+        }
+    });
+    double batchOps = 16 * opsPerSecond(4, [&ring](int t) {
+        int batch[16] = {};
+        if (t % 2 == 0) {
+            ring.push_n(batch, 16);
+        } else {
+            for (std::size_t popped = 0; popped < 16;) {
+                popped += ring.pop_n(batch + popped, 16 - popped);
+            }
+        }
+    }, 10'000);
+    std::cout << "ThreadSafe<std::deque<int>>: " << dequeOps << " ops/s\tThreadSafeQueue<int>: " << ringOps << " ops/s\tThreadSafeQueue<int> (batches of 16): " << batchOps << " ops/s\n";
+
+    //transfers among 16 accounts, each one reading and writing 2 of them: the whole transfer under the locks of a list, or as an optimistic transaction which only locks to copy and to commit
+    thread_safe::ThreadSafe<std::array<long, 8>, thread_safe::Versioned<>> accounts[16];
+    auto pairOf = [](int t) {
+        thread_local unsigned i = 0;
+        ++i;
+        int from = static_cast<int>((i * 7 + t) % 16), to = static_cast<int>((i * 11 + t * 5 + 1) % 16);
+        return std::pair{from, to == from ? (to + 1) % 16 : to};
+    };
+    auto transfer = [](std::array<long, 8>& from, std::array<long, 8>& to) {
+        for (std::size_t i = 0; i < from.size(); ++i) {
+            from[i] -= 1;
+            to[i] += 1;
+        }
+    };
+    double listOps = opsPerSecond(4, [&](int t) {
+        auto [from, to] = pairOf(t);
+        auto [a, b] = thread_safe::lock(accounts[from], accounts[to]);
+        transfer(a, b);
+    });
+    double transactionOps = opsPerSecond(4, [&](int t) {
+        auto [from, to] = pairOf(t);
+        thread_safe::atomically(transfer, accounts[from], accounts[to]);
+    });
+    std::cout << "lock: " << listOps << " ops/s\tatomically: " << transactionOps << " ops/s\n";
+}
+#endif
+
+
+
+#if REENTRANT
+void reentrant() {
+    thread_safe::ThreadSafe<std::vector<int>> ids;
+    thread_safe::ThreadSafe<std::string> log;
+
+    //the objects locked by the list are held by this thread, so the nested accesses do not lock them again (and do not deadlock)
+    (ids, log) ->* (ids->push_back(1), log->append("pushed 1\n"), 0);
+
+    {
+        auto guard = ids.lock();
+        guard->push_back(2);
+        std::cout << ids->size() << " ids\n"; //re-enters the lock held by guard
+    }
+
+    //debug builds report lock-order inversions: waiting for a mutex while holding one with a higher address can deadlock with a list containing both
+#if THREAD_SAFE_LOCK_ORDER_CHECKS
+    thread_safe::lockOrderReporter = [](const thread_safe::LockOrderInversion& inversion) {
+        std::cout << "inversion: " << inversion.acquired << " acquired while holding " << inversion.held << "\n";
+    };
+#endif
+    thread_safe::ThreadSafe<int, std::mutex> pair[2];
+    auto second = pair[1].lock();
+    auto first = pair[0].lock();
+}
+#endif
+
+
+
+#if CONDITIONS
+void conditions() {
+    thread_safe::ThreadSafe<std::deque<int>> jobs;
+
+    //the consumer sleeps until there is a job, instead of polling *jobs in a loop
+    std::thread consumer{[&jobs]() {
+        for (;;) {
+            auto queue = jobs.wait_until([](const auto& q) { return !q.empty(); });
+            int job = queue->front();
+            queue->pop_front();
+            if (job < 0) {
+                return;
+            }
+            std::cout << "job " << job << "\n";
+        }
+    }};
+
+    //each released write access wakes up the consumer, a NotifyBatch wakes it up once for the whole scope
+    jobs->push_back(1);
+    {
+        thread_safe::NotifyBatch batch;
+        jobs->push_back(2);
+        jobs->push_back(3);
+    }
+    jobs->push_back(-1);
+    consumer.join();
 }
 #endif
 
@@ -122,5 +555,39 @@ int main() {
         autoCast();
     #endif
 
+    #if SHARED
+        shared();
+    #endif
+
+    #if COPY_ON_WRITE
+        copyOnWrite();
+    #endif
+
+    #if GUARDS
+        guards();
+    #endif
+
+    #if ACTOR
+        actor();
+    #endif
+
+    #if COROUTINES
+        coroutines();
+    #endif
+
+    #if REENTRANT
+        reentrant();
+    #endif
+
+    #if CONDITIONS
+        conditions();
+    #endif
+
+    #if BENCHMARK
+        benchmark();
+    #endif
+
+    #if PAUSE_AT_EXIT
     int xwgt; std::cin >> xwgt;
+    #endif
 }
@@ -0,0 +1,277 @@
+#ifndef THREAD_SAFE_SHARDED_CONTAINERS
+#define THREAD_SAFE_SHARDED_CONTAINERS
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include "LockPolicies.h"
+
+//Sharded (striped) hash containers: the elements are split among some independently locked ThreadSafe containers, so that threads working on different keys rarely contend. This header is included at the end of ThreadSafe.h.
+namespace thread_safe {
+
+	/**
+	 * @class BasicShardedContainer
+	 * @brief The shards of ThreadSafeShardedMap and ThreadSafeShardedSet, and the operations involving all of them.
+	 * @details Each key belongs to the shard selected by its hash, and each shard is a ThreadSafe container aligned to its own cache line, so that the locks of different shards do not share a cache line either.
+	 * The operations on a single key lock only its shard. The operations on the whole container (size, for_each, snapshot...) lock all of the shards at the same time, always in index order: since the shards are stored in an array this is also their address order, so these operations never deadlock with each other nor with comma separated lists of shards.
+	 * @tparam Container The unordered container stored in each shard.
+	 * @tparam Shards The number of shards.
+	 * @tparam LockPolicy The lock protecting each shard.
+	**/
+	template<typename Container, std::size_t Shards, Lockable LockPolicy>
+	class BasicShardedContainer {
+		static_assert(Shards > 0, "A sharded container needs at least one shard");
+
+		public:
+		using Key = typename Container::key_type;
+		using Shard = ThreadSafe<Container, LockPolicy>;
+
+		private:
+		struct alignas(cacheLineSize) PaddedShard {
+			Shard shard;
+		};
+
+		std::array<PaddedShard, Shards> shards;
+
+		//Locks the shards of self from the i-th on, storing their containers in containers, then calls fn with all of them. The guards are kept on the stack of the recursion, so all of the shards stay locked until fn returns.
+		template<typename Self, typename Containers, typename Function>
+		static void lockFrom(Self& self, std::size_t i, Containers& containers, Function& fn) {
+			if (i == Shards) {
+				fn(containers);
+				return;
+			}
+			auto guard = self.shards[i].shard.lock();
+			containers[i] = &*guard;
+			lockFrom(self, i + 1, containers, fn);
+		}
+
+		protected:
+		BasicShardedContainer() = default;
+
+		//Locks all of the shards of self (in shared mode if self is const and LockPolicy allows it), in index order, and calls fn with the array of the pointers to their containers.
+		template<typename Self, typename Function>
+		static void lockAll(Self& self, Function&& fn) {
+			std::array<std::conditional_t<std::is_const_v<Self>, const Container*, Container*>, Shards> containers{};
+			lockFrom(self, 0, containers, fn);
+		}
+
+
+		public:
+		BasicShardedContainer(const BasicShardedContainer&) = delete;
+		BasicShardedContainer& operator=(const BasicShardedContainer&) = delete;
+
+		/**
+		 * @brief Returns the shard key belongs to, which gives thread-safe access to the container holding it:
+		 * @code
+		 * cache.shardFor(key)->try_emplace(key, value);
+		 * @endcode
+		 * @param key The key to look up.
+		 * @return The ThreadSafe container of the shard.
+		**/
+		Shard& shardFor(const Key& key) {
+			return shards[indexOf(key)].shard;
+		}
+
+		const Shard& shardFor(const Key& key) const {
+			return shards[indexOf(key)].shard;
+		}
+
+		//The index of the shard key belongs to. The hash is mixed before being reduced, since std::hash is the identity for integers and the low bits alone would put consecutive keys in the same few shards when Shards is not prime.
+		std::size_t indexOf(const Key& key) const {
+			std::uint64_t mixed = static_cast<std::uint64_t>(typename Container::hasher{}(key)) * 0x9E3779B97F4A7C15ull;
+			return static_cast<std::size_t>((mixed >> 32) % Shards);
+		}
+
+		//The total number of elements, read with all of the shards locked, so that it is consistent.
+		std::size_t size() const {
+			std::size_t total = 0;
+			lockAll(*this, [&total](const auto& containers) {
+				for (const Container* c : containers) {
+					total += c->size();
+				}
+			});
+			return total;
+		}
+
+		bool empty() const {
+			return size() == 0;
+		}
+
+		//Removes all of the elements, with all of the shards locked.
+		void clear() {
+			lockAll(*this, [](const auto& containers) {
+				for (Container* c : containers) {
+					c->clear();
+				}
+			});
+		}
+
+		/**
+		 * @brief Calls fn on each element, with all of the shards locked.
+		 * @details The shards stay locked by the current thread (and recorded in HeldLocks) while fn runs, so fn can access this container again without deadlocking: e.g. through shardFor, size or contains. It must not add or remove elements though, since that would invalidate the iteration.
+		 * @tparam Function A callable accepting a Container::value_type& (e.g. a std::pair<const Key, Value>& for maps).
+		 * @param fn The operation to run.
+		**/
+		template<typename Function>
+		void for_each(Function&& fn) {
+			lockAll(*this, [&fn](const auto& containers) {
+				for (Container* c : containers) {
+					for (auto& element : *c) {
+						std::invoke(fn, element);
+					}
+				}
+			});
+		}
+
+		//Read-only version of for_each: if LockPolicy is SharedLockable the shards are locked in shared mode, so fn can read this container again but must not modify it (a shared lock cannot be upgraded, so it would deadlock).
+		template<typename Function>
+		void for_each(Function&& fn) const {
+			lockAll(*this, [&fn](const auto& containers) {
+				for (const Container* c : containers) {
+					for (const auto& element : *c) {
+						std::invoke(fn, element);
+					}
+				}
+			});
+		}
+
+		/**
+		 * @brief Copies all of the elements in a single container, with all of the shards locked.
+		 * @return A consistent copy of the whole content.
+		**/
+		Container snapshot() const {
+			Container copy;
+			lockAll(*this, [&copy](const auto& containers) {
+				std::size_t total = 0;
+				for (const Container* c : containers) {
+					total += c->size();
+				}
+				copy.reserve(total);
+				for (const Container* c : containers) {
+					copy.insert(c->begin(), c->end());
+				}
+			});
+			return copy;
+		}
+
+		//Registers each shard under name followed by its index (e.g. `cache[3]`), so that their statistics are reported by dumpStatistics. It does nothing if THREAD_SAFE_STATISTICS is not enabled.
+		void registerAs([[maybe_unused]] std::string_view name) {
+			#if THREAD_SAFE_STATISTICS
+			for (std::size_t i = 0; i < Shards; ++i) {
+				shards[i].shard.registerAs(std::string{name} + "[" + std::to_string(i) + "]");
+			}
+			#endif
+		}
+	};
+
+	/**
+	 * @class ThreadSafeShardedMap
+	 * @brief Hash map whose keys are split among Shards independently locked std::unordered_map (see BasicShardedContainer), so that the throughput of lookups and inserts scales with the number of threads.
+	 * @details The operations on a key lock only the shard of the key. Values are returned by copy, since the shard is not locked anymore once the operation returns: use update (or shardFor) to work on a value in place.
+	 * @tparam Key The type of the keys.
+	 * @tparam Value The type of the values.
+	 * @tparam Shards The number of shards: it should be a few times the number of threads accessing the map.
+	 * @tparam Hash The hash function of the keys, used both to select the shard and within the shard.
+	 * @tparam KeyEqual The equality of the keys.
+	 * @tparam LockPolicy The lock protecting each shard. With a SharedLockable policy (e.g. std::shared_mutex) the const operations lock in shared mode.
+	**/
+	template<typename Key, typename Value, std::size_t Shards = 16, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>, Lockable LockPolicy = std::mutex>
+	class ThreadSafeShardedMap : public BasicShardedContainer<std::unordered_map<Key, Value, Hash, KeyEqual>, Shards, LockPolicy> {
+		public:
+		ThreadSafeShardedMap() = default;
+
+		/**
+		 * @brief Inserts a value constructed from args, if key is not in the map yet.
+		 * @return Whether the value has been inserted.
+		**/
+		template<typename... ArgsType>
+		bool try_emplace(const Key& key, ArgsType&&... args) {
+			return this->shardFor(key)->try_emplace(key, std::forward<ArgsType>(args)...).second;
+		}
+
+		/**
+		 * @brief Inserts value under key, or replaces the value already there.
+		 * @return Whether the value has been inserted (true) or assigned (false).
+		**/
+		template<typename V>
+		bool insert_or_assign(const Key& key, V&& value) {
+			return this->shardFor(key)->insert_or_assign(key, std::forward<V>(value)).second;
+		}
+
+		/**
+		 * @brief Looks up key.
+		 * @return A copy of the value of key, or an empty optional if key is not in the map.
+		**/
+		std::optional<Value> get(const Key& key) const {
+			auto access = this->shardFor(key).lock();
+			auto found = access->find(key);
+			if (found == access->end()) {
+				return std::nullopt;
+			}
+			return found->second;
+		}
+
+		bool contains(const Key& key) const {
+			return this->shardFor(key)->contains(key);
+		}
+
+		//Removes key from the map, returning whether it was there.
+		bool erase(const Key& key) {
+			return this->shardFor(key)->erase(key) != 0;
+		}
+
+		/**
+		 * @brief Runs fn on the value of key (default constructed if key is not in the map), with the shard of key locked.
+		 * @details It is ThreadSafe::apply on the shard, so with a FlatCombining policy the updates of the contending threads are combined.
+		 * @tparam Function A callable accepting a Value&.
+		 * @param key The key whose value is updated.
+		 * @param fn The operation to run.
+		 * @return The value returned by fn (by value).
+		**/
+		template<std::invocable<Value&> Function>
+		auto update(const Key& key, Function&& fn) {
+			return this->shardFor(key).apply([&key, &fn](auto& map) { return std::invoke(fn, map[key]); });
+		}
+	};
+
+	/**
+	 * @class ThreadSafeShardedSet
+	 * @brief Hash set whose keys are split among Shards independently locked std::unordered_set (see BasicShardedContainer and ThreadSafeShardedMap).
+	 * @tparam Key The type of the keys.
+	 * @tparam Shards The number of shards.
+	 * @tparam Hash The hash function of the keys.
+	 * @tparam KeyEqual The equality of the keys.
+	 * @tparam LockPolicy The lock protecting each shard.
+	**/
+	template<typename Key, std::size_t Shards = 16, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>, Lockable LockPolicy = std::mutex>
+	class ThreadSafeShardedSet : public BasicShardedContainer<std::unordered_set<Key, Hash, KeyEqual>, Shards, LockPolicy> {
+		public:
+		ThreadSafeShardedSet() = default;
+
+		//Inserts key, returning whether it was not in the set yet.
+		template<typename K>
+		bool insert(K&& key) {
+			return this->shardFor(key)->insert(std::forward<K>(key)).second;
+		}
+
+		bool contains(const Key& key) const {
+			return this->shardFor(key)->contains(key);
+		}
+
+		//Removes key from the set, returning whether it was there.
+		bool erase(const Key& key) {
+			return this->shardFor(key)->erase(key) != 0;
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef THREAD_SAFE_STATISTICS_HEADER
+#define THREAD_SAFE_STATISTICS_HEADER
+
+#include <atomic>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include "LockPolicies.h"
+
+//Contention instrumentation of ThreadSafe objects. This header is only included (and its code only generated) if THREAD_SAFE_STATISTICS is defined to 1 before including ThreadSafe.h.
+namespace thread_safe {
+
+	//Histogram of durations with logarithmic buckets: bucket i counts the durations in [2^(i-1), 2^i) nanoseconds (bucket 0 counts the durations shorter than 1 ns).
+	class DurationHistogram {
+		static constexpr std::size_t bucketsCount = 40; //The last bucket also counts all of the durations longer than about 9 minutes.
+		std::array<std::atomic<std::uint64_t>, bucketsCount> buckets{};
+
+		public:
+		void record(std::chrono::nanoseconds duration) {
+			auto ns = static_cast<std::uint64_t>(std::max<std::chrono::nanoseconds::rep>(duration.count(), 0));
+			buckets[std::min<std::size_t>(std::bit_width(ns), bucketsCount - 1)].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		//The number of recorded durations.
+		std::uint64_t count() const {
+			std::uint64_t total = 0;
+			for (auto& bucket : buckets) {
+				total += bucket.load(std::memory_order_relaxed);
+			}
+			return total;
+		}
+
+		//Returns the upper bound of the bucket containing the p-th percentile (p in [0, 1]) of the recorded durations.
+		std::chrono::nanoseconds percentile(double p) const {
+			std::uint64_t threshold = static_cast<std::uint64_t>(p * count());
+			std::uint64_t seen = 0;
+			for (std::size_t i = 0; i < bucketsCount; ++i) {
+				seen += buckets[i].load(std::memory_order_relaxed);
+				if (seen > threshold) {
+					return std::chrono::nanoseconds{std::uint64_t{1} << i};
+				}
+			}
+			return std::chrono::nanoseconds{std::uint64_t{1} << (bucketsCount - 1)};
+		}
+	};
+
+	//The statistics collected for a single ThreadSafe object.
+	struct LockStatistics {
+		std::atomic<std::uint64_t> acquisitions{0}; //How many times the lock has been acquired (in any mode).
+		std::atomic<std::uint64_t> contendedAcquisitions{0}; //How many of the acquisitions had to wait because the lock was busy.
+		DurationHistogram waitTime; //Time spent waiting for the lock, only for the contended acquisitions.
+		DurationHistogram holdTime; //Time the lock has been held in exclusive mode, that is the lifetime of the Temp object (or LocksList) which locked it.
+		std::atomic<std::size_t> maxListWidth{0}; //The length of the longest comma separated list the object has been part of.
+
+		void recordListWidth(std::size_t width) {
+			std::size_t current = maxListWidth.load(std::memory_order_relaxed);
+			while (current < width && !maxListWidth.compare_exchange_weak(current, width, std::memory_order_relaxed));
+		}
+	};
+
+	//Keeps the name of all of the ThreadSafe objects registered through ThreadSafe::registerAs.
+	class StatisticsRegistry {
+		std::mutex mtx;
+		std::map<const LockStatistics*, std::string> names;
+
+		StatisticsRegistry() = default;
+
+		public:
+		static StatisticsRegistry& instance() {
+			static StatisticsRegistry registry;
+			return registry;
+		}
+
+		void add(const LockStatistics& stats, std::string_view name) {
+			std::lock_guard guard{mtx};
+			names.insert_or_assign(&stats, std::string{name});
+		}
+
+		void remove(const LockStatistics& stats) {
+			std::lock_guard guard{mtx};
+			names.erase(&stats);
+		}
+
+		/**
+		 * @brief Prints the statistics of the registered objects, sorted by number of contended acquisitions.
+		 * @param out The stream to print to.
+		 * @param top The maximum number of objects to print.
+		**/
+		void dump(std::ostream& out, std::size_t top) {
+			std::lock_guard guard{mtx};
+			std::vector<std::pair<const LockStatistics*, const std::string*>> sorted;
+			for (auto& [stats, name] : names) {
+				sorted.emplace_back(stats, &name);
+			}
+			std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) {
+				return a.first->contendedAcquisitions.load(std::memory_order_relaxed) > b.first->contendedAcquisitions.load(std::memory_order_relaxed);
+			});
+			sorted.resize(std::min(top, sorted.size()));
+
+			for (auto& [stats, name] : sorted) {
+				out << *name
+					<< "\tacquisitions: " << stats->acquisitions.load(std::memory_order_relaxed)
+					<< "\tcontended: " << stats->contendedAcquisitions.load(std::memory_order_relaxed)
+					<< "\twait p50/p99: " << stats->waitTime.percentile(0.5).count() << "/" << stats->waitTime.percentile(0.99).count() << " ns"
+					<< "\thold p50/p99: " << stats->holdTime.percentile(0.5).count() << "/" << stats->holdTime.percentile(0.99).count() << " ns"
+					<< "\tmax list width: " << stats->maxListWidth.load(std::memory_order_relaxed) << "\n";
+			}
+		}
+	};
+
+	//Prints the statistics of the top most contended ThreadSafe objects registered through ThreadSafe::registerAs.
+	inline void dumpStatistics(std::ostream& out, std::size_t top = 10) {
+		StatisticsRegistry::instance().dump(out, top);
+	}
+
+	/**
+	 * @class InstrumentedLock
+	 * @brief Wraps a lock of type LockPolicy, recording the LockStatistics of each acquisition.
+	 * @details ThreadSafe objects use it in place of their LockPolicy when THREAD_SAFE_STATISTICS is enabled, so that Temp objects, LocksList objects and any other locking path are measured the same way.
+	 * An acquisition is contended if try_lock fails: only then the wait is timed. The hold time is measured only for exclusive acquisitions, since the shared ones can overlap.
+	**/
+	template<Lockable LockPolicy>
+	class InstrumentedLock {
+		using Clock = std::chrono::steady_clock;
+
+		LockPolicy lck;
+		LockStatistics stats;
+		Clock::time_point holdStart; //Written after an exclusive acquisition and read before the release, so it is protected by lck itself.
+		bool registered = false;
+
+		public:
+		InstrumentedLock() = default;
+		InstrumentedLock(const InstrumentedLock&) = delete;
+		InstrumentedLock& operator=(const InstrumentedLock&) = delete;
+
+		~InstrumentedLock() {
+			if (registered) {
+				StatisticsRegistry::instance().remove(stats);
+			}
+		}
+
+		void lock() {
+			if (!lck.try_lock()) {
+				auto start = Clock::now();
+				lck.lock();
+				stats.contendedAcquisitions.fetch_add(1, std::memory_order_relaxed);
+				stats.waitTime.record(Clock::now() - start);
+			}
+			stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+			holdStart = Clock::now();
+		}
+
+		bool try_lock() {
+			if (!lck.try_lock()) {
+				return false;
+			}
+			stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+			holdStart = Clock::now();
+			return true;
+		}
+
+		//Only available if LockPolicy has it (e.g. std::timed_mutex), so that access_until keeps waiting on the lock instead of polling it. A timed out attempt is not an acquisition, so it is not recorded.
+		template<typename TimeClock, typename Duration>
+		bool try_lock_until(const std::chrono::time_point<TimeClock, Duration>& deadline) requires requires(LockPolicy& l) { l.try_lock_until(deadline); } {
+			if (!lck.try_lock()) {
+				auto start = Clock::now();
+				if (!lck.try_lock_until(deadline)) {
+					return false;
+				}
+				stats.contendedAcquisitions.fetch_add(1, std::memory_order_relaxed);
+				stats.waitTime.record(Clock::now() - start);
+			}
+			stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+			holdStart = Clock::now();
+			return true;
+		}
+
+		void unlock() {
+			stats.holdTime.record(Clock::now() - holdStart);
+			lck.unlock();
+		}
+
+		//Records an acquisition made directly through the wrapped lock (e.g. an AsyncMutex handed over to a coroutine), which is then released through unlock. The time a coroutine waits suspended is not recorded, since no thread waits.
+		void adopt(bool contended) {
+			if (contended) {
+				stats.contendedAcquisitions.fetch_add(1, std::memory_order_relaxed);
+			}
+			stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+			holdStart = Clock::now();
+		}
+
+		void lock_shared() requires SharedLockable<LockPolicy> {
+			if (!lck.try_lock_shared()) {
+				auto start = Clock::now();
+				lck.lock_shared();
+				stats.contendedAcquisitions.fetch_add(1, std::memory_order_relaxed);
+				stats.waitTime.record(Clock::now() - start);
+			}
+			stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		bool try_lock_shared() requires SharedLockable<LockPolicy> {
+			if (!lck.try_lock_shared()) {
+				return false;
+			}
+			stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		//Shared version of try_lock_until (e.g. for std::shared_timed_mutex).
+		template<typename TimeClock, typename Duration>
+		bool try_lock_shared_until(const std::chrono::time_point<TimeClock, Duration>& deadline) requires SharedLockable<LockPolicy> && requires(LockPolicy& l) { l.try_lock_shared_until(deadline); } {
+			if (!lck.try_lock_shared()) {
+				auto start = Clock::now();
+				if (!lck.try_lock_shared_until(deadline)) {
+					return false;
+				}
+				stats.contendedAcquisitions.fetch_add(1, std::memory_order_relaxed);
+				stats.waitTime.record(Clock::now() - start);
+			}
+			stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		void unlock_shared() requires SharedLockable<LockPolicy> {
+			lck.unlock_shared();
+		}
+
+		void recordListWidth(std::size_t width) {
+			stats.recordListWidth(width);
+		}
+
+		void registerAs(std::string_view name) {
+			StatisticsRegistry::instance().add(stats, name);
+			registered = true;
+		}
+
+		const LockStatistics& statistics() const {
+			return stats;
+		}
+
+		//Returns the wrapped lock, to use the features of LockPolicy which are not instrumented (e.g. optimistic reads).
+		const LockPolicy& policy() const {
+			return lck;
+		}
+
+		LockPolicy& policy() {
+			return lck;
+		}
+	};
+
+	template<Lockable LockPolicy>
+	inline constexpr bool threadOwned<InstrumentedLock<LockPolicy>> = threadOwned<LockPolicy>;
+
+}
+
+#endif
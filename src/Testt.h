@@ -42,13 +42,13 @@ class Testt {
 	}
 
 
-	friend int operator<<(int x, Testt&& t) {
+	friend int operator<<(int x, Testt&&) {
 		std::cout << "\x1B[32mTestt <<rhs\033[0m\n";
 		//t.a = 3;
 		return x+=10;
 	}
 
-	friend int operator<<(int x, Testt& t) {
+	friend int operator<<(int x, Testt&) {
 		std::cout << "\x1B[32mTestt <<rhs\033[0m\n";
 		//t.a = 3;
 		return x += 10;
@@ -2,41 +2,434 @@
 #define THREAD_SAFE_OBJECT
 
 #include <mutex>
+#include <shared_mutex>
 #include <functional>
 #include <vector>
+#include <array>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
 #include <string>
-#include <type_traits> //DEBUG
-#define __cpp_lib_concepts
+#include <type_traits>
+#include <tuple>
+#include <optional>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <exception>
+#include <system_error>
+#if defined(_MSC_VER) && !defined(__cpp_lib_concepts)
+#define __cpp_lib_concepts //MSVS2019 preview needs it to expose <concepts>, but other compilers break if it is defined empty
+#endif
 #include <concepts>
-#include <iostream> //DEBUG
-#include "Testt.h" //DEBUG
+#include <string_view>
+#include <bit>
+#include <cstring>
+#include <ranges>
+#include "LockPolicies.h"
+#include "FlatCombining.h"
+#include "Actor.h"
+#include "Coroutines.h"
+#include "CompactLock.h"
+#include "HeldLocks.h"
+#include "Conditions.h"
+
+//Define THREAD_SAFE_STATISTICS to 1 before including this header to collect the LockStatistics of each ThreadSafe object (see Statistics.h). When it is 0, the instrumentation generates no code and takes no space.
+#ifndef THREAD_SAFE_STATISTICS
+#define THREAD_SAFE_STATISTICS 0
+#endif
+
+#if THREAD_SAFE_STATISTICS
+#include "Statistics.h"
+#endif
+
+//Define THREAD_SAFE_TRACER to one of the tracers of Tracing.h (e.g. thread_safe::RingBufferTracer) before including this header, in order to record each operation performed on ThreadSafe objects.
+//When it is not defined, tracing generates no code and Tracing.h is not even included.
+#ifdef THREAD_SAFE_TRACER
+#include "Tracing.h"
+#define THREAD_SAFE_TRACE(event, object) THREAD_SAFE_TRACER::record(::thread_safe::TraceEvent::event, object)
+#else
+#define THREAD_SAFE_TRACE(event, object) ((void)0)
+#endif
 
 //TODO maybe the Wrapped object should be volatile?
 //C++20 templates needs to be restricted by concepts (they are available in MSVS2019 preview 16.6 v3)
 namespace thread_safe {
 
+	//The lock policy used when none is specified: small arithmetic types are stored in an AtomicWord, so that their single operations are lock-free (see AtomicThreadSafe.h), the other types are protected by a std::mutex.
 	template<typename WrappedType>
+	struct DefaultLockPolicyOf {
+		using type = std::mutex;
+	};
+
+	template<AtomicWordType WrappedType>
+	struct DefaultLockPolicyOf<WrappedType> {
+		using type = AtomicWord<WrappedType>;
+	};
+
+	template<typename WrappedType>
+	using DefaultLockPolicy = typename DefaultLockPolicyOf<WrappedType>::type;
+
+	template<typename WrappedType, Lockable LockPolicy = DefaultLockPolicy<WrappedType>>
 	class ThreadSafe; //forward declaration
 
+	template<std::size_t N>
+	class LocksList; //forward declaration
+
+	//A ThreadSafe object whose const accesses (`->` and `*` on a const reference) take a shared lock, so that concurrent readers do not serialize.
+	template<typename WrappedType>
+	using SharedThreadSafe = ThreadSafe<WrappedType, std::shared_mutex>;
+
+	//A type which can be copied byte by byte, and so read optimistically while a writer may be modifying it.
+	template<typename T>
+	concept TriviallyCopyable = std::is_trivially_copyable_v<T>;
+
+	//A ThreadSafe object whose readers take a lock-free snapshot (see ThreadSafe::snapshot) instead of locking. Writers use `->` and `*` as usual.
+	template<TriviallyCopyable WrappedType>
+	using SeqLockThreadSafe = ThreadSafe<WrappedType, SeqLock>;
+
+	//A ThreadSafe object for many contending threads: the operations run through ThreadSafe::apply are combined by the thread holding the lock (see BasicFlatCombining).
+	template<typename WrappedType>
+	using FlatCombiningThreadSafe = ThreadSafe<WrappedType, FlatCombining>;
+
+	//A ThreadSafe object working as an actor: the operations posted through ThreadSafe::post and ThreadSafe::async are run one at a time by a pool of worker threads (see BasicActor).
+	template<typename WrappedType>
+	using ActorThreadSafe = ThreadSafe<WrappedType, Actor>;
+
+	//A ThreadSafe object protected by a one-byte lock (see CompactLock), for large numbers of small objects: e.g. `CompactThreadSafe<int>` takes 8 bytes.
+	template<typename WrappedType>
+	using CompactThreadSafe = ThreadSafe<WrappedType, CompactLock>;
+
+	//A ThreadSafe object which coroutines can lock without blocking their thread, through `co_await ts.lock_async()` (see AsyncMutex).
+	template<typename WrappedType>
+	using AsyncThreadSafe = ThreadSafe<WrappedType, AsyncMutex>;
+
+	//Runs fn and fulfills promise with its result (or with the exception it throws).
+	template<typename Result, typename Function, typename... ArgsType>
+	void fulfill(std::promise<Result>& promise, Function& fn, ArgsType&&... args) {
+		try {
+			if constexpr (std::is_void_v<Result>) {
+				std::invoke(fn, std::forward<ArgsType>(args)...);
+				promise.set_value();
+			} else {
+				promise.set_value(std::invoke(fn, std::forward<ArgsType>(args)...));
+			}
+		} catch (...) {
+			promise.set_exception(std::current_exception());
+		}
+	}
+
+	//Trait telling whether T is a ThreadSafe object (of any wrapped type and lock policy).
+	template<typename T>
+	struct IsThreadSafe : std::false_type {};
+
+	template<typename WrappedType, Lockable LockPolicy>
+	struct IsThreadSafe<ThreadSafe<WrappedType, LockPolicy>> : std::true_type {};
+
+	//A (possibly const) ThreadSafe object. Const objects are locked in shared mode when they appear in a comma separated list.
+	template<typename T>
+	concept ThreadSafeObject = IsThreadSafe<std::remove_cv_t<T>>::value;
+
+	//Trait telling whether T is a ThreadSafe object protected by an AsyncMutex.
+	template<typename T>
+	struct IsAsyncThreadSafe : std::false_type {};
+
+	template<typename WrappedType>
+	struct IsAsyncThreadSafe<ThreadSafe<WrappedType, AsyncMutex>> : std::true_type {};
+
+	//A (possibly const) ThreadSafe object which can be locked by a suspended coroutine (see lock_async).
+	template<typename T>
+	concept AsyncThreadSafeObject = IsAsyncThreadSafe<std::remove_cv_t<T>>::value;
+
+	template<AsyncThreadSafeObject... Objects>
+	class LocksAwaiter; //forward declaration
+
+	template<ThreadSafeObject... Objects>
+	class LocksGuard; //forward declaration
+
+	//The type of the lock actually stored in a ThreadSafe object with the given LockPolicy: the policy itself or, if statistics are enabled, the policy wrapped in an InstrumentedLock.
+	#if THREAD_SAFE_STATISTICS
+	template<Lockable LockPolicy>
+	using InternalLock = InstrumentedLock<LockPolicy>;
+	#else
+	template<Lockable LockPolicy>
+	using InternalLock = LockPolicy;
+	#endif
+
+	//Returns the AsyncMutex stored in lock (the internal lock of an AsyncThreadSafe object), looking through the instrumentation (if statistics are enabled).
+	template<typename Lock>
+	AsyncMutex& asyncMutexOf(Lock& lock) {
+		#if THREAD_SAFE_STATISTICS
+		return lock.policy();
+		#else
+		return lock;
+		#endif
+	}
+
+	//Records, in the statistics of lock (only if THREAD_SAFE_STATISTICS is enabled), an acquisition made directly through its AsyncMutex.
+	template<typename Lock>
+	void recordAsyncAcquisition([[maybe_unused]] Lock& lock, [[maybe_unused]] bool contended) {
+		#if THREAD_SAFE_STATISTICS
+		lock.adopt(contended);
+		#endif
+	}
+
+	//The operations needed to drive a mutex whose type has been erased, in a given mode (exclusive or shared).
+	struct LockOps {
+		void (*lock)(void*);
+		bool (*tryLock)(void*);
+		void (*unlock)(void*);
+		bool exclusive; //Whether the mutex is locked in exclusive mode.
+		bool tracked; //Whether the mutex is recorded among the locks held by the current thread (see threadOwned).
+		#if THREAD_SAFE_STATISTICS
+		void (*recordListWidth)(void*, std::size_t);
+		#endif
+	};
+
+	//Builds the LockOps of MutexType. If Shared is true and MutexType is SharedLockable they act in shared mode, otherwise in exclusive mode.
+	template<typename MutexType, bool Shared>
+	constexpr LockOps makeLockOps() {
+		LockOps ops{};
+		if constexpr (Shared && SharedLockable<MutexType>) {
+			ops.lock = [](void* m) { static_cast<MutexType*>(m)->lock_shared(); };
+			ops.tryLock = [](void* m) { return static_cast<MutexType*>(m)->try_lock_shared(); };
+			ops.unlock = [](void* m) { static_cast<MutexType*>(m)->unlock_shared(); };
+		} else {
+			ops.lock = [](void* m) { static_cast<MutexType*>(m)->lock(); };
+			ops.tryLock = [](void* m) { return static_cast<MutexType*>(m)->try_lock(); };
+			ops.unlock = [](void* m) { static_cast<MutexType*>(m)->unlock(); };
+		}
+		ops.exclusive = !(Shared && SharedLockable<MutexType>);
+		ops.tracked = threadOwned<MutexType>;
+		#if THREAD_SAFE_STATISTICS
+		ops.recordListWidth = [](void* m, std::size_t width) {
+			if constexpr (requires(MutexType& l) { l.recordListWidth(width); }) {
+				static_cast<MutexType*>(m)->recordListWidth(width);
+			}
+		};
+		#endif
+		return ops;
+	}
+
+	template<typename MutexType, bool Shared>
+	inline constexpr LockOps lockOpsOf = makeLockOps<MutexType, Shared>();
+
+	//Type-erased handle to a mutex, which is unlocked on destruction if the handle owns it. LocksList needs it in order to keep, in the same list, mutexes of different types locked either in exclusive or in shared mode.
+	//A mutex already held by the current thread (see HeldLocks) is not locked again: the handle re-enters it, granting access without owning it.
+	class LockHandle {
+		void* mtx = nullptr; //The guarded mutex.
+		const LockOps* ops = nullptr; //The operations to lock and unlock mtx in the mode chosen on construction.
+		bool owns = false; //Whether mtx is currently locked through this handle.
+		bool reentered = false; //Whether mtx was already held by the current thread when this handle was locked.
+
+		LockHandle(void* mtx, const LockOps* ops) : mtx{mtx}, ops{ops} {}
+
+		//Whether the current thread already holds mtx in a mode allowing the access of this handle.
+		bool heldByThisThread() const {
+			return ops->tracked && HeldLocks::reenters(mtx, ops->exclusive);
+		}
+
+		//Marks mtx as locked through this handle, recording it among the locks held by the current thread.
+		void acquired() {
+			owns = true;
+			if (ops->tracked) {
+				HeldLocks::add(mtx, ops->exclusive);
+			}
+		}
+
+		public:
+		//Constructs an empty handle, which refers to no mutex. It is needed to allocate the inline storage of a LocksList.
+		LockHandle() = default;
+
+		//Returns a handle to m, without locking it. If Shared is true and MutexType is SharedLockable the mutex will be locked in shared mode, otherwise in exclusive mode.
+		template<bool Shared, typename MutexType>
+		static LockHandle of(MutexType& m) {
+			return LockHandle{&m, &lockOpsOf<MutexType, Shared>};
+		}
+
+		void lock() {
+			if ((reentered = heldByThisThread())) {
+				return;
+			}
+			if (ops->tracked) {
+				HeldLocks::acquiring(mtx);
+			}
+			ops->lock(mtx);
+			acquired();
+		}
+
+		bool tryLock() {
+			if ((reentered = heldByThisThread())) {
+				return true;
+			}
+			if (!ops->tryLock(mtx)) {
+				return false;
+			}
+			acquired();
+			return true;
+		}
+
+		//Unlocks mtx if it is owned by this handle, waking up the threads waiting for a change of its object if it was locked in exclusive mode. A re-entered mutex is left to its owner.
+		void unlock() {
+			if (owns) {
+				if (ops->tracked) {
+					HeldLocks::remove(mtx);
+				}
+				ops->unlock(mtx);
+				owns = false;
+				if (ops->exclusive) {
+					notifyWaiters(mtx);
+				}
+			}
+			reentered = false;
+		}
+
+		#if THREAD_SAFE_STATISTICS
+		//Records, in the statistics of the guarded mutex, that it has been part of a list of width mutexes.
+		void recordListWidth(std::size_t width) {
+			ops->recordListWidth(mtx, width);
+		}
+		#endif
+
+		//Makes this handle own the guarded mutex, which has already been locked in the mode chosen on construction (e.g. by lock_async).
+		void adopt() {
+			acquired();
+		}
+
+		//Whether the guarded mutex is currently accessible through this handle: either owned or re-entered.
+		bool isLocked() const {
+			return owns || reentered;
+		}
+
+		//The address of the guarded mutex, which defines the global order in which mutexes are acquired.
+		std::uintptr_t address() const {
+			return reinterpret_cast<std::uintptr_t>(mtx);
+		}
+
+		LockHandle(LockHandle&& other) noexcept : mtx{other.mtx}, ops{other.ops}, owns{std::exchange(other.owns, false)}, reentered{std::exchange(other.reentered, false)} {
+		}
+
+		LockHandle(const LockHandle&) = delete;
+		LockHandle& operator=(const LockHandle&) = delete;
+		LockHandle& operator=(LockHandle&& other) noexcept {
+			if (this != &other) {
+				if (owns) unlock();
+				mtx = other.mtx;
+				ops = other.ops;
+				owns = std::exchange(other.owns, false);
+				reentered = std::exchange(other.reentered, false);
+			}
+			return *this;
+		}
+
+		~LockHandle() {
+			if (owns) unlock();
+		}
+	};
+
 	//C++20 this class should not be visible from outside, but it cannot be a nested class of ThreadSafe (because it is a template class), so maybe it can be NOT exported(?)
-	//TODO there is the big problem that this mechanism is not deadlock safe. Example: 2 different threads run at the same time (ts1, ts2, ts3)->*... and (ts3, ts2, ts1)->*... The first thread locks ts1, the second thread locks ts3, the first locks ts2, the second tries to lock ts2 (but cannot), the first triest to lock ts3 (but cannot). A way to solve this is to make a thread release all of the mutex acquired in the comma separated list as soon as it fails to lock a mutex (and retry immediately), but there is the risk that the same situation goes on forever! Maybe it is possible to implement an algorithm similiar to the CSMACA (for wifi) but it would be slow (I think).
-	//This object contains an array of unique_locks. It is instantiated temporarily, so that all of the ThreadSafe objects in a comma separated list are locked for the duration of the statement.
+	//This object contains an array of N lock handles. It is instantiated temporarily, so that all of the ThreadSafe objects in a comma separated list are locked for the duration of the statement.
+	//The size of the list is known at compile time: each `,` operator builds a LocksList<N+1> from the LocksList<N> on its left, so the handles are stored inline and no heap allocation takes place.
+	//ThreadSafe objects appearing in the list through a const reference are locked in shared mode (if their mutex supports it), the others are locked exclusively.
+	//Lists are deadlock free: 2 different threads can run at the same time (ts1, ts2, ts3)->*... and (ts3, ts2, ts1)->*... The rule is that a thread never waits for a mutex while it holds another mutex with a higher address (see `add`).
+	//Mutexes arriving in increasing address order are simply locked, so the common case costs exactly one lock per object. A mutex arriving out of order is only tried: if it is busy, all of the locks held by the list are released and then taken again, waiting for each of them, in address order. Since the fallback waits instead of retrying, it cannot livelock.
+	//Objects already locked by the current thread (by an enclosing Temp or list, or earlier in the same list) are re-entered instead of locked again (see LockHandle). If THREAD_SAFE_LOCK_ORDER_CHECKS is enabled, a list waiting for a mutex while the thread holds one with a higher address from outside the list reports the inversion (see HeldLocks::acquiring).
+	template<std::size_t N>
 	class LocksList {
-		template<typename WrappedType> friend class ThreadSafe; //ThreadSafe must be the only class able to create and interact with a LocksList object.
-		using unique_lock = std::unique_lock<std::mutex>;
-		std::vector<unique_lock> lockGuards; //The list of the locked mutexes (throughout unique_lock) guarded by this object.
+		template<typename WrappedType, Lockable LockPolicy> friend class ThreadSafe; //ThreadSafe must be the only class able to create and interact with a LocksList object.
+		template<std::size_t M> friend class LocksList; //A LocksList steals the handles of the shorter list it is built from.
+		template<ThreadSafeObject... Objects> friend class LocksGuard; //A LocksGuard builds a LocksList which only tries the locks (see try_lock).
+		std::array<LockHandle, N> lockGuards; //The list of the locked mutexes (throughout LockHandle) guarded by this object.
+
+		//Constructs a LocksList object made up of 2 lock handles guarding the internal mutexes of the ThreadSafe objects passed as arguments.
+		template <ThreadSafeObject A, ThreadSafeObject B>
+		requires (N == 2)
+		LocksList(A& ts1, B& ts2) {
+			lockGuards[0] = handleOf(ts1);
+			lockGuards[0].lock();
+			add(1, handleOf(ts2));
+			recordListWidth();
+		}
+
+		//Constructs a LocksList object taking ownership of all of the handles of locks, plus a new lock handle guarding the internal mutex of the ThreadSafe object passed as argument.
+		template <ThreadSafeObject A>
+		LocksList(LocksList<N - 1>&& locks, A& ts) {
+			for (std::size_t i = 0; i < N - 1; ++i) {
+				lockGuards[i] = std::move(locks.lockGuards[i]);
+			}
+			add(N - 1, handleOf(ts));
+			recordListWidth();
+		}
+
+		//Constructs a LocksList object which tries to lock all of the ThreadSafe objects passed as arguments, without waiting. If any of them is busy, the ones already locked are released, so the list either holds all of the locks or none of them (see ownsAll).
+		//Since no lock is waited for, the order in which they are tried does not matter.
+		template <ThreadSafeObject... Objects>
+		requires (sizeof...(Objects) == N)
+		LocksList(std::try_to_lock_t, Objects&... ts) : lockGuards{handleOf(ts)...} {
+			for (auto h = lockGuards.begin(); h != lockGuards.end(); ++h) {
+				if (!h->tryLock()) {
+					while (h != lockGuards.begin()) {
+						(--h)->unlock();
+					}
+					return;
+				}
+			}
+			recordListWidth();
+		}
+
+		//Constructs a LocksList object taking ownership of the mutexes of all of the ThreadSafe objects passed as arguments, which have already been locked (see lock_async).
+		template <ThreadSafeObject... Objects>
+		requires (sizeof...(Objects) == N)
+		LocksList(std::adopt_lock_t, Objects&... ts) : lockGuards{handleOf(ts)...} {
+			for (auto& h : lockGuards) {
+				h.adopt();
+			}
+			recordListWidth();
+		}
+
+		//Whether all of the mutexes of the list are locked. It is only false for a list which failed to try them.
+		bool ownsAll() const {
+			return std::all_of(lockGuards.begin(), lockGuards.end(), [](const LockHandle& h) { return h.isLocked(); });
+		}
 
-		//Constructs a LocksList object made up of 2 unique_lock(s) guarding the internal mutexes of the ThreadSafe objects passed as arguments.
-		template <typename A, typename B>
-		LocksList(ThreadSafe<A>& ts1, ThreadSafe<B>& ts2) {
-			lockGuards.push_back(unique_lock(ts1.mtx));
-			lockGuards.push_back(unique_lock(ts2.mtx));
+		//Records the width of this list in the statistics of all of its objects (only if THREAD_SAFE_STATISTICS is enabled).
+		void recordListWidth() {
+			#if THREAD_SAFE_STATISTICS
+			for (auto& h : lockGuards) {
+				h.recordListWidth(N);
+			}
+			#endif
 		}
 
-		//Adds a new unique_lock, guarding the internal mutex of the ThreadSafe object passed as argument, to the list
-		template <typename A>
-		void add(ThreadSafe<A>& ts) {
-			lockGuards.push_back(unique_lock(ts.mtx));
+		//Returns a (not yet locked) handle to the internal mutex of the ThreadSafe object passed as argument, which is going to be locked in shared mode if the object is const.
+		template <ThreadSafeObject A>
+		static LockHandle handleOf(A& ts) {
+			return LockHandle::of<std::is_const_v<A>>(ts.mtx);
+		}
+
+		//Stores handle at position count and locks it, given that the first count handles are already locked.
+		//The new mutex is waited for only if its address is higher than the address of all of the held ones, otherwise it is just tried. If the attempt fails, all of the held mutexes are released and the whole list is locked again in address order.
+		void add(std::size_t count, LockHandle handle) {
+			lockGuards[count] = std::move(handle);
+			LockHandle& added = lockGuards[count];
+			auto held = lockGuards.begin() + count;
+
+			if (std::all_of(lockGuards.begin(), held, [&added](const LockHandle& h) { return h.address() < added.address(); })) {
+				added.lock();
+				return;
+			}
+			if (added.tryLock()) {
+				return;
+			}
+
+			for (auto h = lockGuards.begin(); h != held; ++h) {
+				h->unlock();
+			}
+			std::sort(lockGuards.begin(), held + 1, [](const LockHandle& a, const LockHandle& b) { return a.address() < b.address(); });
+			for (auto h = lockGuards.begin(); h != held + 1; ++h) {
+				h->lock();
+			}
 		}
 
 
@@ -60,65 +453,196 @@ namespace thread_safe {
 		/**
 		 * @brief The `->*` operator is used to chain an operation after a LocksList list.
 		 * @details Any operaton can be executed with safe access to the ThreadSafe objects mentioned in the left-hand-side list. 
-		 * If during the operation specified as rhs, at any point, one of the ThreadSafe objects mentioned in the lhs list is accessed through `->` or `*` operators, or is mentioned in a comma separated list (preceded only by ThreadSafe objects or as first item of such list), a deadlock will occur.
+		 * During the operation specified as rhs, the ThreadSafe objects mentioned in the lhs list can also be accessed through `->` or `*` operators, or mentioned in another comma separated list: they are already held by the current thread, so they are not locked again (see HeldLocks).
 		 * The first parameter is not used at all, but it is necessary to call this overload only when the operator has a LocksList as lhs.
 		 * @tparam Return The same return type of the operation specifeid as rhs.
 		 * @param ret The operation to execute.
 		 * @return Return
 		**/
 		template<typename Return>
-		friend Return&& operator->*(const LocksList&, Return&& ret) {
-			std::cout << "\x1B[31mLocksList ->* (const LocksList&, Return&&)\033[0m\n"; //DEBUG
+		friend Return&& operator->*([[maybe_unused]] const LocksList& locks, Return&& ret) {
+			THREAD_SAFE_TRACE(LocksListArrowStar, &locks);
 			return std::forward<Return>(ret);
 		}
 
 
 		//Comma operators are declared here because they need to be friend with both LocksList and ThreadSafe. This is because I'd like LocksList objects to expose no methods, since they are just an artifact to group more ThreadSafe objects present in a comma separated list.
-		template <typename A, typename B>
-		friend LocksList operator,(ThreadSafe<A>& ts1, ThreadSafe<B>& ts2);
+		template <ThreadSafeObject A, ThreadSafeObject B>
+		friend LocksList<2> operator,(A& ts1, B& ts2);
 
-		template <typename A>
-		friend LocksList operator,(LocksList locks, ThreadSafe<A>& ts);
+		template <std::size_t M, ThreadSafeObject A>
+		friend LocksList<M + 1> operator,(LocksList<M>&& locks, A& ts);
 	};
 
+	//Base of all of the Temp objects, so that the operators forwarded to their wrapped objects recognize them (see unwrapTemp).
+	struct TempBase {};
+
+	//A (possibly const or reference) Temp object, of any ThreadSafe object.
+	template<typename T>
+	concept TempObject = std::derived_from<std::remove_cvref_t<T>, TempBase>;
+
+	//Returns the object wrapped in operand as an lvalue if operand is a Temp object, otherwise operand itself, forwarded as it has been received. The wrapped object is never copied nor moved: to move it, the reference returned by `*` must be moved explicitly (e.g. `std::move(**ts)`).
+	template<typename T>
+	decltype(auto) unwrapTemp(T&& operand) {
+		if constexpr (TempObject<T>) {
+			return *operand;
+		} else {
+			return std::forward<T>(operand);
+		}
+	}
+
+	//Forwards the binary operator op to the wrapped objects of its Temp operands, so that e.g. `*a == *b`, `*counter += 2` and `std::cout << *name` work on the wrapped objects with their locks held, as the same expressions on unprotected objects.
+	//Two Temp operands lock their objects in evaluation order: objects which other threads may lock in the opposite order should be compared through a comma separated list instead.
+	#define THREAD_SAFE_FORWARD_BINARY_OPERATOR(op) \
+	template<typename LHS, typename RHS> \
+	requires (TempObject<LHS> || TempObject<RHS>) && requires(LHS&& lhs, RHS&& rhs) { unwrapTemp(std::forward<LHS>(lhs)) op unwrapTemp(std::forward<RHS>(rhs)); } \
+	decltype(auto) operator op(LHS&& lhs, RHS&& rhs) { \
+		return unwrapTemp(std::forward<LHS>(lhs)) op unwrapTemp(std::forward<RHS>(rhs)); \
+	}
+
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(==)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(!=)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(<)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(<=)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(>)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(>=)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(<=>)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(+)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(-)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(*)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(/)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(%)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(&)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(|)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(^)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(<<)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(>>)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(&&)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(||)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(+=)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(-=)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(*=)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(/=)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(%=)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(&=)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(|=)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(^=)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(<<=)
+	THREAD_SAFE_FORWARD_BINARY_OPERATOR(>>=)
+
+	#undef THREAD_SAFE_FORWARD_BINARY_OPERATOR
+
+	//Forwards the prefix operator op to the wrapped object of a Temp object, e.g. `++*counter` or `!*flag`.
+	#define THREAD_SAFE_FORWARD_PREFIX_OPERATOR(op) \
+	template<TempObject T> \
+	requires requires(T&& temp) { op unwrapTemp(std::forward<T>(temp)); } \
+	decltype(auto) operator op(T&& temp) { \
+		return op unwrapTemp(std::forward<T>(temp)); \
+	}
+
+	THREAD_SAFE_FORWARD_PREFIX_OPERATOR(+)
+	THREAD_SAFE_FORWARD_PREFIX_OPERATOR(-)
+	THREAD_SAFE_FORWARD_PREFIX_OPERATOR(!)
+	THREAD_SAFE_FORWARD_PREFIX_OPERATOR(~)
+	THREAD_SAFE_FORWARD_PREFIX_OPERATOR(++)
+	THREAD_SAFE_FORWARD_PREFIX_OPERATOR(--)
+
+	#undef THREAD_SAFE_FORWARD_PREFIX_OPERATOR
+
+	template<TempObject T>
+	requires requires(T&& temp) { unwrapTemp(std::forward<T>(temp))++; }
+	decltype(auto) operator++(T&& temp, int) {
+		return unwrapTemp(std::forward<T>(temp))++;
+	}
+
+	template<TempObject T>
+	requires requires(T&& temp) { unwrapTemp(std::forward<T>(temp))--; }
+	decltype(auto) operator--(T&& temp, int) {
+		return unwrapTemp(std::forward<T>(temp))--;
+	}
+
 	/**
 	 * @class ThreadSafe
 	 * @brief The class associates an object of type WrappedType with a mutex. Each time the object is accessed with `->` or `*` operators, the associated mutex is locked.
 	 * @details The mutex is locked with a unique_lock encapsulated in a temporary object anonimously returned by the `->` and `*` operators. Such temporary object defines a `->` operator which returns a pointer to the object wrapped in the ThreadSafe object who created it. Due to arrow operation concatenation rule of C++, this the operator is called whenever the `->` is called on the ThreadSafe object.
 	 * The class provides an overload of `~` operator to access the wrapped in object in a non thread-safe way without any overhead.
 	 * The `,` operator is also overloaded in order to protect multiple ThreadSafe objects at the same time and perform any operation avoiding data races on the protected objects.
-	 * Referencing an object in the same statement in which it has been locked will cause a deadlock. This means that in a statement where the object is referenced throught `->` or `*` or appears in a comma separated list of ThreadSafe objects, it should be only be accessed throught `~` operator.
+	 * The thread holding the internal mutex (e.g. in the rhs of `->*`, or while a guard returned by lock exists) can access the object again through `->`, `*` or a comma separated list: such nested accesses do not lock the mutex again (see HeldLocks). A read-only access nested into a shared one is re-entrant too, while a read-write access nested into a shared one still deadlocks (it is reported in debug builds).
+	 * A thread can sleep until the object satisfies a predicate with wait_until: the read-write accesses wake it up when they release the object (see NotifyBatch to batch them).
+	 * Accessing the object through a const reference (e.g. `std::as_const(ts)->...`) only grants read access. If LockPolicy is SharedLockable (e.g. std::shared_mutex) such accesses take a shared lock, so concurrent readers do not block each other.
+	 * With a CacheAligned policy (e.g. `CacheAligned<std::mutex>`) the object is aligned to a cache line, so that objects next to each other do not share one.
+	 * @tparam WrappedType The type of the protected object.
+	 * @tparam LockPolicy The type of the internal lock: std::mutex, std::shared_mutex, one of the policies in LockPolicies.h (SpinLock, AdaptiveLock, TicketLock) or any other Lockable type. It defaults to DefaultLockPolicy<WrappedType>.
 	**/
-	template <typename WrappedType>
-	class ThreadSafe {
+	template <typename WrappedType, Lockable LockPolicy>
+	class alignas(WrappedType) alignas(InternalLock<LockPolicy>) alignas(layoutAlignmentOf<LockPolicy>) ThreadSafe {
+
+		using Lock = InternalLock<LockPolicy>; //The type of the internal lock (LockPolicy, possibly instrumented).
 
 		//The temporary class instantiated each time an object of type ThreadSafe is accessed. The object is destroyed at the end of the full expression where it has been accessed.
-		class Temp {
-			ThreadSafe* real; //The reference to the permanent object.
-			std::lock_guard<std::mutex> guard {real->mtx};
+		//If ReadOnly is true, the Temp object has been created by a const access: it only exposes a const WrappedType and (if LockPolicy allows it) it holds a shared lock.
+		template<bool ReadOnly>
+		class BasicTemp : public TempBase {
+			using Owner = std::conditional_t<ReadOnly, const ThreadSafe, ThreadSafe>;
+			using Wrapped = std::conditional_t<ReadOnly, const WrappedType, WrappedType>;
+			using Guard = std::conditional_t<ReadOnly && SharedLockable<Lock>, std::shared_lock<Lock>, std::unique_lock<Lock>>;
+
+			Owner* real; //The reference to the permanent object.
+			Guard guard; //Empty if the current thread already held the internal mutex when this Temp was created: the access is re-entrant, and the mutex is released by its first holder.
+
+			//Locks the internal mutex of real, unless the current thread already holds it, and records it among the locks held by the thread (see HeldLocks).
+			static Guard lockUnlessHeld(Owner& real) {
+				if (real.template heldByThisThread<ReadOnly>()) {
+					return Guard{};
+				}
+				if constexpr (threadOwned<Lock>) {
+					HeldLocks::acquiring(&real.mtx);
+				}
+				Guard guard{real.mtx};
+				real.template registerHeld<ReadOnly>();
+				return guard;
+			}
 
 
 			public:
-			//Constructs a Temp object given a ThreadSafe reference. This is the only way to build a Temp object.
-			Temp(ThreadSafe& real) : real{&real} {
-				std::cout << "\x1B[46mTemp ctor\033[0m\n"; //DEBUG
+			//Constructs a Temp object given a ThreadSafe reference, locking its internal mutex (unless the current thread already holds it).
+			BasicTemp(Owner& real) : real{&real}, guard{lockUnlessHeld(real)} {
+				THREAD_SAFE_TRACE(TempCtor, this->real);
+			}
+
+			//Constructs a Temp object given a ThreadSafe reference whose internal mutex has already been locked (in the mode required by this Temp), e.g. by ThreadSafe::try_access.
+			BasicTemp(Owner& real, std::adopt_lock_t) : real{&real}, guard{real.mtx, std::adopt_lock} {
+				real.template registerHeld<ReadOnly>();
+				THREAD_SAFE_TRACE(TempCtor, this->real);
 			}
 
-			//DEBUG
-			~Temp() {
-				std::cout << "\x1B[46mTemp dtor\033[0m\n"; //DEBUG
+			//Releases the internal mutex, if this Temp locked it. A read-write Temp then wakes up the threads waiting for a change of the object (see wait_until).
+			~BasicTemp() {
+				THREAD_SAFE_TRACE(TempDtor, real);
+				if (guard.owns_lock()) {
+					real->unregisterHeld();
+					guard.unlock();
+					if constexpr (!ReadOnly) {
+						notifyWaiters(&real->mtx);
+					}
+				}
 			}
 
 			//Returns the object wrapped in the ThreadSafe object used to build this Temp Object. A pointer is returned because `->` needs a pointer as return type.
-			WrappedType* operator->() {
-				std::cout << "\x1B[36mTemp ->\033[0m\n"; //DEBUG
+			Wrapped* operator->() const {
+				THREAD_SAFE_TRACE(TempArrow, real);
 				return &(real->wrappedObj);
 			}
 
-			//TODO now it is const to be compatible with the overloaded <<
+			//Returns the object wrapped in the ThreadSafe object used to build this Temp object, e.g. to use a guard returned by ThreadSafe::lock as `*guard`.
+			Wrapped& operator*() const {
+				THREAD_SAFE_TRACE(TempDereference, real);
+				return real->wrappedObj;
+			}
+
 			//Converts the Temp object to the WrappedType of the ThreadSafe object used to constructs this Temp object.
-			operator WrappedType&() {
-				std::cout << "\x1B[36mTemp cast\033[0m\n"; //DEBUG
+			operator Wrapped&() const {
+				THREAD_SAFE_TRACE(TempCast, real);
 				return real->wrappedObj;
 			}
 
@@ -126,15 +650,15 @@ namespace thread_safe {
 			/**
 			 * @brief The `->*` operator is used to chain an operation after the locking of a ThreadSafe object.
 			 * @details Any operation can be executed with safe access to the ThreadSafe object mentioned in the left-hand-side.
-			 * If during the operation specified as rhs, at any point, the ThreadSafe objects mentioned in the lhs is accessed through `->` or `*` operators, or is mentioned in a comma separated list (preceded only by ThreadSafe objects or as first item of such list), a deadlock  will occur.
+			 * During the operation specified as rhs, the ThreadSafe object mentioned in the lhs can also be accessed through `->` or `*` operators, or mentioned in a comma separated list: it is already held by the current thread, so it is not locked again (see HeldLocks).
 			 * The first parameter is not used at all, but it is necessary to call this overload only when the operator has a single locked ThreadSafe object as lhs.
 			 * @tparam Return The same return type of the operation specifeid as rhs.
 			 * @param ret The operation to execute.
 			 * @return Return
 			*/
 			template<typename Return>
-			friend Return&& operator->*(const Temp&, Return&& ret) {
-				std::cout << "\x1B[36mThreadSafe ->*\033[0m\n"; //DEBUG
+			friend Return&& operator->*([[maybe_unused]] const BasicTemp& temp, Return&& ret) {
+				THREAD_SAFE_TRACE(TempArrowStar, temp.real);
 				return std::forward<Return>(ret);
 			}
 
@@ -144,73 +668,206 @@ namespace thread_safe {
 
 
 
-			//TODO make all of the operators, but before understand well the functioning of this very operator!
-//Should LHS be constrained by a "Has<<" concept? (Imho no, because if the user messed up it's his problem, not mine. This is just a wrapper.)
-// probabilmente non era una buona idea fare che prendeva un ThreadSafe, perch se poi un operatore vuole ricevere tutto l'oggetto thread safe e non solo il wrapped, come fa? (soprattutto nel caso di move, lo protegge ma poi ne perde la responsabilit, e il nuovo proprietario ha solo l'oggetto wrapped protetto, ma non pu sproteggerlo, perch la responsabilit della protezione  rimasta al vecchio proprietario)
-			/**
-			 * @brief Calls the `<<` operator by forwarding the generic left-hand-side and by casting the right-hand-side of type ThreadSafe<WrappedType> to the WrappedType.
-			 * @tparam LHS The type of the left-hand-side operand.
-			 * @tparam TS The type of the right-hand-side operand, which must be a ThreadSafe<WrappedType>.
-			 * @param lhs The left-hand-side operand.
-			 * @param ts The right-hand-side operand, which must be a ThreadSafe<WrappedType> object.
-			 * @return The same object returned by the `<<` operator called with lhs as left-hand-side and ts converted to its WrappedType as right-hand-side.
-			**/
-			template<typename LHS, typename TS>
-			requires std::same_as<Temp, typename std::remove_cvref<TS>::type>
-			friend decltype(auto) operator<<(LHS&& lhs, TS&& ts) {
-
-				//ways to call:
-				// xxx << ts; A
-				// xxx << move(ts); B
-				// xxx << Ts{...}; C
-
-				//ways to receive:
-				// << (Xxx, Ts) by val 1
-				// << (Xxx, Ts&) by lvalue ref 2
-				// << (Xxx, const Ts&) by const lvalue ref 3
-				// << (Xxx, Ts&&) by rvalue ref 4
-
-				//combinations:
-				// A 1 --> copy ctor
-				// A 2 --> nothing
-				// A 3 --> nothing
-				// A 4 --> error
-				// B 1 --> move ctor
-				// B 2 --> error
-				// B 3 --> nothing
-				// B 4 --> nothing
-				// C 1 --> likely copy elision (?)
-				// C 2 --> error
-				// C 3 --> nothing
-				// C 4 --> nothing
-
-				//se mi danno un rvalue (C) esso dovr subire move, perch dentro questo wrapper quell'rvalue ha un nome (il nome dell'arg), dunque  un lvalue, quindi devo trasformarlo in un //value
-				//se mi danno un lvalue (A), lo devo passare normalmente
-				//se mi danno un rvalue (B) devo fare come se mi dessero un (C)
-				bool noref = std::is_same<Temp, TS>::value; //DEBUG
-				bool lvref = std::is_lvalue_reference_v<TS>; //DEBUG
-				bool rvref = std::is_rvalue_reference_v<TS>; //DEBUG
-
-				std::cout << "\x1B[31mTemp <<rhs\033[0m\n"; //DEBUG
-				return std::forward<LHS>(lhs) << std::move(ts.operator WrappedType & ());
-
-			}
-
-			/*
-
-			L'obiettivo  passare a << un rvalue se ts  stato passato come rvalue, e un lvalue se ts  stato passato come un lvalue. Il << pu accettare by value, by lvalue reference, by const lvalue reference, by rvalue reference. Ma const non ci interessa qui (tanto poi  dentro la funzione << che sar const), l'unica differenza  se prende by value o by reference.
+			//Subscripts the wrapped object, e.g. `(*table)[i]` or `(*cache)["key"]`.
+			template<typename Index>
+			requires requires(Wrapped& wrapped, Index&& index) { wrapped[std::forward<Index>(index)]; }
+			decltype(auto) operator[](Index&& index) const {
+				return (**this)[std::forward<Index>(index)];
+			}
 
-			*/
+			//Calls the wrapped object, e.g. `(*callback)(args)`.
+			template<typename... ArgsType>
+			requires std::invocable<Wrapped&, ArgsType...>
+			decltype(auto) operator()(ArgsType&&... args) const {
+				return std::invoke(**this, std::forward<ArgsType>(args)...);
+			}
 
+			//Iterators over the wrapped object, so that a range-for keeps it locked for the whole loop: `for (auto& element : *vector)`.
+			auto begin() const requires std::ranges::range<Wrapped&> {
+				return std::ranges::begin(**this);
+			}
 
+			auto end() const requires std::ranges::range<Wrapped&> {
+				return std::ranges::end(**this);
+			}
+		};
 
+		using Temp = BasicTemp<false>; //Temp object granting read-write access.
+		using ConstTemp = BasicTemp<true>; //Temp object granting read-only access.
 
+		mutable Lock mtx; //Internal lock associated with the wrappedObj. It is mutable because const accesses must lock it too. It comes first so that, with a CacheAligned policy, it starts the cache line which wrappedObj shares.
+		WrappedType wrappedObj; //Object to wrap into this ThreadSafe object
 
+		//Returns the internal lock as a LockPolicy, looking through the instrumentation (if statistics are enabled).
+		const LockPolicy& lockPolicy() const {
+			#if THREAD_SAFE_STATISTICS
+			return mtx.policy();
+			#else
+			return mtx;
+			#endif
+		}
 
-		};
+		LockPolicy& lockPolicy() {
+			#if THREAD_SAFE_STATISTICS
+			return mtx.policy();
+			#else
+			return mtx;
+			#endif
+		}
 
-		WrappedType wrappedObj; //Object to wrap into this ThreadSafe object
-		std::mutex mtx; //Internal mutex associated with the wrappedObj
+		//Tries to lock the internal mutex without waiting: in shared mode if Shared is true and the lock allows it, otherwise in exclusive mode.
+		template<bool Shared>
+		bool tryLock() const {
+			if constexpr (Shared && SharedLockable<Lock>) {
+				return mtx.try_lock_shared();
+			} else {
+				return mtx.try_lock();
+			}
+		}
+
+		//Tries to lock the internal mutex (see tryLock) until deadline. If the lock has no timed operations (e.g. std::mutex), it is tried repeatedly, backing off between the attempts.
+		template<bool Shared, typename Clock, typename Duration>
+		bool tryLockUntil(const std::chrono::time_point<Clock, Duration>& deadline) const {
+			if constexpr (Shared && SharedLockable<Lock> && requires(Lock& l) { l.try_lock_shared_until(deadline); }) {
+				return mtx.try_lock_shared_until(deadline);
+			} else if constexpr (!(Shared && SharedLockable<Lock>) && requires(Lock& l) { l.try_lock_until(deadline); }) {
+				return mtx.try_lock_until(deadline);
+			} else {
+				for (unsigned attempts = 0; !tryLock<Shared>(); ++attempts) {
+					if (Clock::now() >= deadline) {
+						return false;
+					}
+					if (attempts < 64) {
+						cpuRelax();
+					} else {
+						std::this_thread::yield();
+					}
+				}
+				return true;
+			}
+		}
+
+		//Whether the current thread already holds the internal mutex in a mode allowing an access of the given kind (see HeldLocks): such an access proceeds without locking it again.
+		template<bool Shared>
+		bool heldByThisThread() const {
+			if constexpr (threadOwned<Lock>) {
+				return HeldLocks::reenters(&mtx, !(Shared && SharedLockable<Lock>));
+			} else {
+				return false;
+			}
+		}
+
+		//Records the internal mutex among the locks held by the current thread, once it has been locked for an access of the given kind.
+		template<bool Shared>
+		void registerHeld() const {
+			if constexpr (threadOwned<Lock>) {
+				HeldLocks::add(&mtx, !(Shared && SharedLockable<Lock>));
+			}
+		}
+
+		//Removes the internal mutex from the locks held by the current thread, before it is unlocked.
+		void unregisterHeld() const {
+			if constexpr (threadOwned<Lock>) {
+				HeldLocks::remove(&mtx);
+			}
+		}
+
+		//Locks the internal mutex: in shared mode if Shared is true and the lock allows it, otherwise in exclusive mode.
+		template<bool Shared>
+		void lockFor() const {
+			if constexpr (Shared && SharedLockable<Lock>) {
+				mtx.lock_shared();
+			} else {
+				mtx.lock();
+			}
+		}
+
+		//Unlocks the internal mutex, locked by lockFor with the same Shared.
+		template<bool Shared>
+		void unlockFor() const {
+			if constexpr (Shared && SharedLockable<Lock>) {
+				mtx.unlock_shared();
+			} else {
+				mtx.unlock();
+			}
+		}
+
+		//Locks the internal mutex (see lockFor) and waits until pred holds: while it does not, the thread is parked with the mutex released, until the object is released by a writer.
+		template<bool Shared, typename Predicate>
+		void lockWhen(Predicate& pred) const {
+			THREAD_SAFE_TRACE(ThreadSafeWait, this);
+			if constexpr (threadOwned<Lock>) {
+				HeldLocks::acquiring(&mtx);
+			}
+			lockFor<Shared>();
+			while (!std::invoke(pred, std::as_const(wrappedObj))) {
+				ConditionLot::park(&mtx, [this]() {
+					unlockFor<Shared>(); //Released with the bucket of the parking lot locked, so a writer cannot notify before the thread is parked.
+					return true;
+				});
+				lockFor<Shared>();
+			}
+		}
+
+		//Same as lockWhen, but it gives up at deadline, returning false with the mutex unlocked.
+		template<bool Shared, typename Predicate, typename Clock, typename Duration>
+		bool lockWhenUntil(Predicate& pred, const std::chrono::time_point<Clock, Duration>& deadline) const {
+			THREAD_SAFE_TRACE(ThreadSafeWait, this);
+			if constexpr (threadOwned<Lock>) {
+				HeldLocks::acquiring(&mtx);
+			}
+			lockFor<Shared>();
+			while (!std::invoke(pred, std::as_const(wrappedObj))) {
+				if (Clock::now() >= deadline) {
+					unlockFor<Shared>();
+					return false;
+				}
+				ConditionLot::parkUntil(&mtx, [this]() {
+					unlockFor<Shared>();
+					return true;
+				}, deadline);
+				lockFor<Shared>();
+			}
+			return true;
+		}
+
+		//Awaitable returned by lock_async. It resumes the awaiting coroutine with a Temp (or a ConstTemp) once the internal AsyncMutex has been locked or handed over to it.
+		template<bool ReadOnly>
+		class LockAwaiter : LockWaiter {
+			using Owner = std::conditional_t<ReadOnly, const ThreadSafe, ThreadSafe>;
+
+			Owner& owner;
+
+			public:
+			explicit LockAwaiter(Owner& owner) : owner{owner} {
+				wake = [](LockWaiter* waiter) {
+					recordAsyncAcquisition(static_cast<LockAwaiter*>(waiter)->owner.mtx, true);
+					resumeHandedOver(*waiter);
+				};
+			}
+
+			bool await_ready() {
+				if (!asyncMutexOf(owner.mtx).try_lock()) {
+					return false;
+				}
+				recordAsyncAcquisition(owner.mtx, false);
+				return true;
+			}
+
+			//Suspends the coroutine only if the mutex is still busy. Once queued, the awaiter is not touched anymore, since another thread may resume the coroutine at once.
+			bool await_suspend(std::coroutine_handle<> awaiting) {
+				coroutine = awaiting;
+				if (!asyncMutexOf(owner.mtx).lockOrEnqueue(*this)) {
+					return true;
+				}
+				recordAsyncAcquisition(owner.mtx, false);
+				return false;
+			}
+
+			BasicTemp<ReadOnly> await_resume() {
+				return BasicTemp<ReadOnly>{owner, std::adopt_lock};
+			}
+		};
 
 
 		public:
@@ -223,7 +880,7 @@ namespace thread_safe {
 		**/
 		template<typename ...ArgsType>
 		ThreadSafe(ArgsType&&... args) : wrappedObj(std::forward<ArgsType>(args)...) {
-			std::cout << "\x1B[41mThreadSafe ctor\033[0m\n"; //DEBUG
+			THREAD_SAFE_TRACE(ThreadSafeCtor, this);
 		}
 
 		/**
@@ -232,7 +889,7 @@ namespace thread_safe {
 		 * @param ts ThreadSafe obeject to copy.
 		**/
 		ThreadSafe(ThreadSafe& ts) : wrappedObj{ts.wrappedObj} {
-			std::cout << "\x1B[41mThreadSafe copy ctor\033[0m\n"; //DEBUG
+			THREAD_SAFE_TRACE(ThreadSafeCopyCtor, this);
 		}
 
 		/**
@@ -241,7 +898,7 @@ namespace thread_safe {
 		 * @param ts ThreadSafe obeject to copy.
 		**/
 		ThreadSafe& operator=(ThreadSafe& ts) {
-			std::cout << "\x1B[41mThreadSafe copy =\033[0m\n"; //DEBUG
+			THREAD_SAFE_TRACE(ThreadSafeCopyAssign, this);
 			wrappedObj = ts.wrappedObj;
 			return *this;
 		}
@@ -253,7 +910,7 @@ namespace thread_safe {
 		 * @param ts ThreadSafe obeject to move.
 		**/
 		ThreadSafe(ThreadSafe&& ts) : wrappedObj{ std::move(ts.wrappedObj)} {
-			std::cout << "\x1B[41mThreadSafe move ctor\033[0m\n"; //DEBUG
+			THREAD_SAFE_TRACE(ThreadSafeMoveCtor, this);
 		}
 
 		/**
@@ -262,8 +919,16 @@ namespace thread_safe {
 		 * @param ts ThreadSafe obeject to move.
 		**/
 		ThreadSafe& operator=(ThreadSafe&& ts) {
-			std::cout << "\x1B[41mThreadSafe move =\033[0m\n"; //DEBUG
+			THREAD_SAFE_TRACE(ThreadSafeMoveAssign, this);
 			wrappedObj = std::move(ts.wrappedObj);
+			return *this;
+		}
+
+		~ThreadSafe() = default;
+
+		//The lock comes before the wrapped object, so it is destroyed after it: the operations still queued on an actor are run before the wrapped object is destroyed.
+		~ThreadSafe() requires ActorLockable<LockPolicy> {
+			lockPolicy().waitIdle();
 		}
 		
 
@@ -274,11 +939,20 @@ namespace thread_safe {
 		 * @return An anonymous temporary object of type Temp, which holds a reference to this object, and locks the internal mutex on creation using a unique_lock.
 		*/
 		Temp operator->() {
-			std::cout << "\x1B[31mThreadSafe ->\033[0m\n"; //DEBUG
+			THREAD_SAFE_TRACE(ThreadSafeArrow, this);
 			return Temp{*this};
 		}
 
-		//this method always returns a rvalue (not a ref to an lvalue) and this is bad, because this hides the way an object has been passed to a method (I cannot pass a protected object to a method by lvalue reference). On the other hand it is the only way to destroy the Temp object at the end of the full expression.
+		/**
+		 * @brief The arrow operator used on a const ThreadSafe object grants read-only access to the members of the WrappedType object in a thread-safe way.
+		 * @details It behaves like the non-const overload, but the returned temporary object exposes a const WrappedType. If LockPolicy is SharedLockable the internal mutex is locked in shared mode, so concurrent readers run in parallel.
+		 * @return An anonymous temporary object of type ConstTemp, which holds a reference to this object, and locks the internal mutex on creation.
+		**/
+		ConstTemp operator->() const {
+			THREAD_SAFE_TRACE(ThreadSafeConstArrow, this);
+			return ConstTemp{*this};
+		}
+
 		/**
 		 * @brief The dereference operator is used to get the instance of the wrapped in object in a thread-safe way.
 		 * @details This operator allows to perform statements like: 
@@ -288,13 +962,233 @@ namespace thread_safe {
 		 * @endcode
 		 * in a thread-safe way. 
 		 * When a ThreadSafe object is dereferenced, a temporary object is returned. Such temporary object can be implicitly converted to WrappedType.
+		 * The temporary object also forwards the operators of WrappedType (comparison, arithmetic, `<<`, `[]`, `()`, begin and end for range-for) to the wrapped object as an lvalue, so `*a == *b` or `std::cout << *safe` neither copy nor move it. To move it out, `std::move(**safe)` must be written explicitly.
 		 * @return An anonymous temporary object of type Temp, which holds a reference to this object, and locks the internal mutex on creation using a unique_lock.
 		**/
 		Temp operator*() {
-			std::cout << "\x1B[31mThreadSafe *\033[0m\n"; //DEBUG
+			THREAD_SAFE_TRACE(ThreadSafeDereference, this);
+			return Temp{*this};
+		}
+
+		/**
+		 * @brief The dereference operator used on a const ThreadSafe object is used to read the instance of the wrapped in object in a thread-safe way.
+		 * @details If LockPolicy is SharedLockable the internal mutex is locked in shared mode, so concurrent readers run in parallel.
+		 * @return An anonymous temporary object of type ConstTemp, which holds a reference to this object, and locks the internal mutex on creation.
+		**/
+		ConstTemp operator*() const {
+			THREAD_SAFE_TRACE(ThreadSafeConstDereference, this);
+			return ConstTemp{*this};
+		}
+
+		/**
+		 * @brief Locks the internal mutex for a whole scope, so that many operations on the wrapped object cost one lock acquisition.
+		 * @details The returned Temp object must be stored in a variable, and it works as a guard: the object can be accessed through it (`guard->...`, `*guard`) until the variable goes out of scope.
+		 * @code
+		 * auto guard = safe.lock();
+		 * guard->append("Hello");
+		 * guard->append(" world!");
+		 * @endcode
+		 * While the guard exists, the same thread can still access the object through `->` and `*` of the ThreadSafe object: the mutex is not locked again.
+		 * @return A Temp object holding the lock. It cannot be moved, but it is initialized in place thanks to guaranteed copy elision.
+		**/
+		Temp lock() {
+			return Temp{*this};
+		}
+
+		/**
+		 * @brief Locks the internal mutex for a whole scope granting read-only access (see the non-const overload). If LockPolicy is SharedLockable the mutex is locked in shared mode.
+		 * @return A ConstTemp object holding the lock.
+		**/
+		ConstTemp lock() const {
+			return ConstTemp{*this};
+		}
+
+		/**
+		 * @brief Locks the internal mutex only if it is free, without waiting.
+		 * @details The returned object works as the guard returned by lock, and it is empty if the mutex was busy:
+		 * @code
+		 * if (auto access = safe.try_access()) {
+		 *     (*access)->append("Hello");
+		 * }
+		 * @endcode
+		 * If the current thread already holds the mutex, the access is re-entrant and always succeeds.
+		 * @return An optional holding a Temp object if the mutex has been locked, an empty optional otherwise.
+		**/
+		std::optional<Temp> try_access() {
+			THREAD_SAFE_TRACE(ThreadSafeTryAccess, this);
+			if (heldByThisThread<false>()) {
+				return std::optional<Temp>{std::in_place, *this};
+			}
+			if (!tryLock<false>()) {
+				return std::nullopt;
+			}
+			return std::optional<Temp>{std::in_place, *this, std::adopt_lock};
+		}
+
+		//Read-only version of try_access: if LockPolicy is SharedLockable the mutex is locked in shared mode.
+		std::optional<ConstTemp> try_access() const {
+			THREAD_SAFE_TRACE(ThreadSafeTryAccess, this);
+			if (heldByThisThread<true>()) {
+				return std::optional<ConstTemp>{std::in_place, *this};
+			}
+			if (!tryLock<true>()) {
+				return std::nullopt;
+			}
+			return std::optional<ConstTemp>{std::in_place, *this, std::adopt_lock};
+		}
+
+		/**
+		 * @brief Locks the internal mutex, waiting at most until deadline.
+		 * @details The lock is waited for with LockPolicy::try_lock_until if it is available (e.g. std::timed_mutex), otherwise it is tried repeatedly until deadline.
+		 * @param deadline The time after which the attempt is abandoned.
+		 * @return An optional holding a Temp object if the mutex has been locked, an empty optional otherwise.
+		**/
+		template<typename Clock, typename Duration>
+		std::optional<Temp> access_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+			THREAD_SAFE_TRACE(ThreadSafeTryAccess, this);
+			if (heldByThisThread<false>()) {
+				return std::optional<Temp>{std::in_place, *this};
+			}
+			if (!tryLockUntil<false>(deadline)) {
+				return std::nullopt;
+			}
+			return std::optional<Temp>{std::in_place, *this, std::adopt_lock};
+		}
+
+		//Read-only version of access_until: if LockPolicy is SharedLockable the mutex is locked in shared mode.
+		template<typename Clock, typename Duration>
+		std::optional<ConstTemp> access_until(const std::chrono::time_point<Clock, Duration>& deadline) const {
+			THREAD_SAFE_TRACE(ThreadSafeTryAccess, this);
+			if (heldByThisThread<true>()) {
+				return std::optional<ConstTemp>{std::in_place, *this};
+			}
+			if (!tryLockUntil<true>(deadline)) {
+				return std::nullopt;
+			}
+			return std::optional<ConstTemp>{std::in_place, *this, std::adopt_lock};
+		}
+
+		/**
+		 * @brief Locks the internal mutex, waiting at most for timeout (see access_until).
+		 * @param timeout The maximum time to wait.
+		 * @return An optional holding a Temp object if the mutex has been locked, an empty optional otherwise.
+		**/
+		template<typename Rep, typename Period>
+		std::optional<Temp> access_for(const std::chrono::duration<Rep, Period>& timeout) {
+			return access_until(std::chrono::steady_clock::now() + timeout);
+		}
+
+		//Read-only version of access_for: if LockPolicy is SharedLockable the mutex is locked in shared mode.
+		template<typename Rep, typename Period>
+		std::optional<ConstTemp> access_for(const std::chrono::duration<Rep, Period>& timeout) const {
+			return access_until(std::chrono::steady_clock::now() + timeout);
+		}
+
+		/**
+		 * @brief Waits until pred holds for the wrapped object, then returns a guard keeping it locked, as lock does.
+		 * @details pred is checked with the internal mutex locked. While it does not hold, the thread sleeps with the mutex released (so it does not burn a core polling the object), and checks it again each time another thread releases a read-write access to the object: a Temp object, a comma separated list, apply...
+		 * @code
+		 * auto jobs = queue.wait_until([](const auto& q) { return !q.empty(); });
+		 * Job job = std::move(jobs->front());
+		 * jobs->pop_front();
+		 * @endcode
+		 * If the calling thread holds the object already, nobody else can change it: pred is checked once, and if it does not hold the wait would never end, so a std::system_error with code std::errc::resource_deadlock_would_occur is thrown instead (as std::unique_lock does when locking a mutex it owns).
+		 * @tparam Predicate A callable accepting a const WrappedType& and returning whether the wait is over.
+		 * @param pred The condition to wait for.
+		 * @return A Temp object holding the lock, taken while pred holds.
+		**/
+		template<std::predicate<const WrappedType&> Predicate>
+		Temp wait_until(Predicate&& pred) {
+			if (!heldByThisThread<false>()) {
+				lockWhen<false>(pred);
+				return Temp{*this, std::adopt_lock};
+			}
+			if (!std::invoke(pred, std::as_const(wrappedObj))) {
+				throw std::system_error{std::make_error_code(std::errc::resource_deadlock_would_occur), "wait_until on an object held by this thread"};
+			}
 			return Temp{*this};
 		}
 
+		//Read-only version of wait_until: if LockPolicy is SharedLockable the mutex is locked in shared mode, so many readers can wait at the same time.
+		template<std::predicate<const WrappedType&> Predicate>
+		ConstTemp wait_until(Predicate&& pred) const {
+			if (!heldByThisThread<true>()) {
+				lockWhen<true>(pred);
+				return ConstTemp{*this, std::adopt_lock};
+			}
+			if (!std::invoke(pred, wrappedObj)) {
+				throw std::system_error{std::make_error_code(std::errc::resource_deadlock_would_occur), "wait_until on an object held by this thread"};
+			}
+			return ConstTemp{*this};
+		}
+
+		/**
+		 * @brief Waits until pred holds for the wrapped object (see wait_until), at most until deadline.
+		 * @param pred The condition to wait for.
+		 * @param deadline The time after which the wait is abandoned.
+		 * @return An optional holding a Temp object if pred holds, an empty optional if deadline expired first.
+		**/
+		template<std::predicate<const WrappedType&> Predicate, typename Clock, typename Duration>
+		std::optional<Temp> wait_until(Predicate&& pred, const std::chrono::time_point<Clock, Duration>& deadline) {
+			if (heldByThisThread<false>()) {
+				return std::invoke(pred, std::as_const(wrappedObj)) ? std::optional<Temp>{std::in_place, *this} : std::nullopt;
+			}
+			if (!lockWhenUntil<false>(pred, deadline)) {
+				return std::nullopt;
+			}
+			return std::optional<Temp>{std::in_place, *this, std::adopt_lock};
+		}
+
+		//Read-only version of the timed wait_until: if LockPolicy is SharedLockable the mutex is locked in shared mode.
+		template<std::predicate<const WrappedType&> Predicate, typename Clock, typename Duration>
+		std::optional<ConstTemp> wait_until(Predicate&& pred, const std::chrono::time_point<Clock, Duration>& deadline) const {
+			if (heldByThisThread<true>()) {
+				return std::invoke(pred, wrappedObj) ? std::optional<ConstTemp>{std::in_place, *this} : std::nullopt;
+			}
+			if (!lockWhenUntil<true>(pred, deadline)) {
+				return std::nullopt;
+			}
+			return std::optional<ConstTemp>{std::in_place, *this, std::adopt_lock};
+		}
+
+		/**
+		 * @brief Waits until pred holds for the wrapped object (see wait_until), at most for timeout.
+		 * @param pred The condition to wait for.
+		 * @param timeout The maximum time to wait.
+		 * @return An optional holding a Temp object if pred holds, an empty optional if the timeout expired first.
+		**/
+		template<std::predicate<const WrappedType&> Predicate, typename Rep, typename Period>
+		std::optional<Temp> wait_for(Predicate&& pred, const std::chrono::duration<Rep, Period>& timeout) {
+			return wait_until(std::forward<Predicate>(pred), std::chrono::steady_clock::now() + timeout);
+		}
+
+		//Read-only version of wait_for: if LockPolicy is SharedLockable the mutex is locked in shared mode.
+		template<std::predicate<const WrappedType&> Predicate, typename Rep, typename Period>
+		std::optional<ConstTemp> wait_for(Predicate&& pred, const std::chrono::duration<Rep, Period>& timeout) const {
+			return wait_until(std::forward<Predicate>(pred), std::chrono::steady_clock::now() + timeout);
+		}
+
+		/**
+		 * @brief Locks the internal mutex from a coroutine, suspending it (instead of blocking its thread) while the mutex is busy.
+		 * @details The awaiting coroutine is resumed when the mutex is handed over to it, on the thread which released it, and it gets the same guard returned by lock:
+		 * @code
+		 * auto access = co_await safe.lock_async();
+		 * access->append("Hello");
+		 * @endcode
+		 * A coroutine holding the guard across a suspension point keeps the mutex locked: the coroutines waiting for it stay suspended, while threads (using `->`, `*`, lists...) block as usual.
+		 * @return An awaitable resuming the coroutine with a Temp object holding the lock.
+		**/
+		auto lock_async() requires AsyncLockable<LockPolicy> {
+			THREAD_SAFE_TRACE(ThreadSafeLockAsync, this);
+			return LockAwaiter<false>{*this};
+		}
+
+		//Read-only version of lock_async: the coroutine is resumed with a ConstTemp object.
+		auto lock_async() const requires AsyncLockable<LockPolicy> {
+			THREAD_SAFE_TRACE(ThreadSafeLockAsync, this);
+			return LockAwaiter<true>{*this};
+		}
+
 		/**
 		 * @brief This operator is used to get the naked WrappedType object.
 		 * @details Since `~` operator has a lower priority than mamber access operator (`.`), is almost always needed that the sub-expression `~threadSafeObject` is enclosed inside parentheses:
@@ -305,90 +1199,440 @@ namespace thread_safe {
 		 * @return 
 		**/
 		WrappedType& operator~() {
-			std::cout << "\x1B[31mThreadSafe ~\033[0m\n"; //DEBUG
+			THREAD_SAFE_TRACE(ThreadSafeTilde, this);
 			return wrappedObj;
 		}
 
+		/**
+		 * @brief Runs fn on the wrapped object in a thread-safe way and returns its result.
+		 * @details The internal mutex is locked for the duration of the call. If LockPolicy is FlatCombiningLockable, concurrent calls are combined: the thread holding the lock runs the operations of all of the waiting threads, and each result is handed back to its caller.
+		 * The object can also be written as lhs of `->*`: `ts ->* [](auto& v) { ... }`.
+		 * If the current thread already holds the mutex, fn is simply called (without locking or combining). fn can access the object again, even when another thread runs it on behalf of the current one (see BasicFlatCombining).
+		 * @tparam Function A callable accepting a WrappedType&.
+		 * @param fn The operation to run.
+		 * @return The value returned by fn. It is returned by value, since the object is not protected anymore when apply returns.
+		**/
+		template<std::invocable<WrappedType&> Function>
+		auto apply(Function&& fn) {
+			THREAD_SAFE_TRACE(ThreadSafeApply, this);
+			using Result = std::decay_t<std::invoke_result_t<Function&, WrappedType&>>;
+			if (heldByThisThread<false>()) {
+				return static_cast<Result>(std::invoke(fn, wrappedObj));
+			}
+			if constexpr (FlatCombiningLockable<LockPolicy>) {
+				struct Notify {
+					const ThreadSafe& ts;
+					~Notify() { notifyWaiters(&ts.mtx); }
+				} notify{*this}; //fn may have been run by another thread: the waiters are notified once it has returned.
+				return lockPolicy().combine(mtx, wrappedObj, fn);
+			} else {
+				Temp guard{*this};
+				return static_cast<Result>(std::invoke(fn, wrappedObj));
+			}
+		}
 
+		//Same as ts.apply(fn).
+		template<std::invocable<WrappedType&> Function>
+		friend auto operator->*(ThreadSafe& ts, Function&& fn) {
+			return ts.apply(std::forward<Function>(fn));
+		}
 
-		//TOREMOVE
-//		template<typename TS, typename RHS>
-//		requires std::same_as<ThreadSafe<WrappedType>, typename std::remove_cvref<TS>::type>
-//		friend decltype(auto) operator<<(TS&& ts, RHS&& rhs) {
-//			std::cout << "\x1B[31mThreadSafe <<lhs\033[0m\n"; //DEBUG
-//			return std::forward<WrappedType>(WrappedType(ts.protect())) << std::forward<RHS>(rhs);
-//		}
+		/**
+		 * @brief Queues fn, to be run on the wrapped object by the WorkerPool, and returns at once.
+		 * @details The operations posted to the same object are run one at a time, in the order they have been posted, while the internal mutex is held. Exceptions thrown by fn are discarded.
+		 * @tparam Function A callable accepting a WrappedType&. It is copied (or moved) into the queue.
+		 * @param fn The operation to run.
+		**/
+		template<std::invocable<WrappedType&> Function>
+		void post(Function&& fn) requires ActorLockable<LockPolicy> {
+			THREAD_SAFE_TRACE(ThreadSafePost, this);
+			lockPolicy().post(mtx, wrappedObj, std::forward<Function>(fn));
+		}
 
+		/**
+		 * @brief Queues fn like post, and returns a future which will receive its result (or the exception it throws).
+		 * @tparam Function A callable accepting a WrappedType&.
+		 * @param fn The operation to run.
+		 * @return The future result of fn.
+		**/
+		template<std::invocable<WrappedType&> Function>
+		auto async(Function&& fn) requires ActorLockable<LockPolicy> {
+			using Result = std::decay_t<std::invoke_result_t<Function&, WrappedType&>>;
+			std::promise<Result> promise;
+			std::future<Result> result = promise.get_future();
+			post([fn = std::forward<Function>(fn), promise = std::move(promise)](WrappedType& wrapped) mutable {
+				fulfill(promise, fn, wrapped);
+			});
+			return result;
+		}
 
+		/**
+		 * @brief Registers this object under a name, so that its statistics are reported by dumpStatistics.
+		 * @details It does nothing if THREAD_SAFE_STATISTICS is not enabled, so it can be left in the code of any build.
+		 * @param name The name the object is reported with.
+		**/
+		void registerAs([[maybe_unused]] std::string_view name) {
+			#if THREAD_SAFE_STATISTICS
+			mtx.registerAs(name);
+			#endif
+		}
+
+		/**
+		 * @brief Returns a copy of the wrapped object, read optimistically without locking and without writing any shared memory.
+		 * @details The object is copied byte by byte between LockPolicy::beginRead and LockPolicy::validateRead: if a writer acquired the lock in the meanwhile, the copy may be torn, so it is discarded and the read is retried.
+		 * It is only available for trivially copyable objects protected by a lock supporting optimistic reads, such as SeqLock. If the current thread holds the lock, the object is simply copied.
+		 * @return A consistent copy of the wrapped object.
+		**/
+		WrappedType snapshot() const requires TriviallyCopyable<WrappedType> && OptimisticReadLockable<LockPolicy> {
+			if (heldByThisThread<true>()) {
+				return wrappedObj;
+			}
+			const LockPolicy& seq = lockPolicy();
+			std::array<unsigned char, sizeof(WrappedType)> copy;
+			for (;;) {
+				std::uint32_t version = seq.beginRead();
+				std::memcpy(copy.data(), &wrappedObj, sizeof(WrappedType));
+				if (seq.validateRead(version)) {
+					return std::bit_cast<WrappedType>(copy);
+				}
+			}
+		}
+
+		//Returns the version of the wrapped object (see Versioned), which changes each time an exclusive access to it is released (unless keepVersion has been called). It is stable while the current thread holds the object.
+		std::uint64_t version() const requires VersionedLockable<LockPolicy> {
+			return lockPolicy().version();
+		}
+
+		//Tells that the current exclusive access has not written the wrapped object, so that releasing it leaves the version unchanged (see Versioned::keepVersion). The current thread must hold the object in exclusive mode.
+		void keepVersion() requires VersionedLockable<LockPolicy> {
+			lockPolicy().keepVersion();
+		}
+
+		#if THREAD_SAFE_STATISTICS
+		//Returns the contention statistics collected for this object.
+		const LockStatistics& statistics() const {
+			return mtx.statistics();
+		}
+		#endif
 
 
 
-	
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///										FRIENDS												///
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		friend class LocksList; //LocksList objects needs to access some private members of ThreadSafe objects (in particular mtx).
+		template<std::size_t N> friend class LocksList; //LocksList objects needs to access some private members of ThreadSafe objects (in particular mtx).
+		template<AsyncThreadSafeObject... Objects> friend class LocksAwaiter; //LocksAwaiter objects lock the AsyncMutex in mtx.
 
 		//Comma operators are declared here because they need to be friend with both LocksList and ThreadSafe.
-		template <typename A, typename B>
-		friend LocksList operator,(ThreadSafe<A>& ts1, ThreadSafe<B>& ts2);
+		template <ThreadSafeObject A, ThreadSafeObject B>
+		friend LocksList<2> operator,(A& ts1, B& ts2);
 
-		template <typename A>
-		friend LocksList operator,(LocksList locks, ThreadSafe<A>& ts);
+		template <std::size_t M, ThreadSafeObject A>
+		friend LocksList<M + 1> operator,(LocksList<M>&& locks, A& ts);
 
 	};
 
 
 	
-	//TODO args should be const references (and mtx mutable)?
 	/**
 		 * @name Comma Operator
 		 * @brief LocksList the internal mutexes of a list of comma separated ThreadSafe objects.
-		 * @details The order of evaluation of comma operator is left to right. The first pair of ThreadSafe objects of the list will call a specific overload of the `,` operator,					which	returns a newly constructed anonymous temporary object containing a list of unique_lock(s). The formal type of this object is LocksList. The first list			contains only       the 2	  unique_lock(s) relative to the internal mutexes of its arguments. The subsequent pairs of ThreadSafe objects will call another overload of `,`		operator, which		takes as arguments  a LocksList object (the one built by the previous `,` operator) and another ThreadSafe object. The internal mutex of this last		ThreadSafe object is		assigned to a unique_lock	 and added to the list of the LocksList object. The lock object is anonymously returned, so it can be chained	with	another ThreadSafe object, and		  so on. For example:
+		 * @details The order of evaluation of comma operator is left to right. The first pair of ThreadSafe objects of the list will call a specific overload of the `,` operator,					which	returns a newly constructed anonymous temporary object containing a list of lock handles. The formal type of this object is LocksList<2>. The first list			contains only       the 2	  lock handles relative to the internal mutexes of its arguments. The subsequent pairs of ThreadSafe objects will call another overload of `,`		operator, which		takes as arguments  a LocksList<N> object (the one built by the previous `,` operator) and another ThreadSafe object. The handles of the LocksList<N> are moved into a new LocksList<N+1> object, together with a handle locking the internal mutex of the last ThreadSafe object. The new lock object is anonymously returned, so it can be chained	with	another ThreadSafe object, and		  so on. Since the length of the list is a template parameter, the handles are stored inline and no heap allocation takes place. For example:
 		 * @code
 		 *    (ts1, ts2, ts3, ts4);
 		 * // --------->called: operator,(ThreadSafe<A>&, ThreadSafe<B>&)
 		 *    (locks,    ts3, ts4);
-		 * // -------------->called: operator,(LocksList, ThreadSafe<A>&)
+		 * // -------------->called: operator,(LocksList<2>&&, ThreadSafe<A>&)
 		 *    (locks,         ts4);
-		 * // ------------------->called: operator,(LocksList, ThreadSafe<A>&)
+		 * // ------------------->called: operator,(LocksList<3>&&, ThreadSafe<A>&)
 		 *     locks;
 		 * @endcode
-		 * @warning **Deadlock** If the same ThreadSafe object appears multiple time on the list, a deadlock happens.
+		 * ThreadSafe objects appearing in the list through a const reference (e.g. `(std::as_const(ts1), ts2)`) are locked in shared mode if their mutex is SharedLockable, so the same statement can hold some objects shared and others exclusive.
+		 * Objects with different lock policies can be mixed in the same list.
+		 * The mutexes are acquired in a deadlock free way, so lists mentioning the same objects in different orders can safely run at the same time on different threads (see LocksList).
+		 * An object appearing multiple times on the list, or already locked by the current thread, is locked only once (see HeldLocks).
+		 * @warning **Deadlock** If an object is held in shared mode (e.g. through a const reference) and the list needs it in exclusive mode, a deadlock happens.
 		 * @warning **Unexpected behaviour** If the first N objects of a comma separated list are of type ThreadSafe, they will be merged into a LocksList object and their internal				mutexes	 will be locked, with potential unexpected behaviours.
 		**/
 	///@{
 	/**
 		 * @brief This overload is invoked on the first pair of ThreadSafe objects in a list of comma separated ThreadSafe objects.
-		 * @tparam A The type of the object wrapped in the first ThreadSafe argument.
-		 * @tparam B The type of the object wrapped in the second ThreadSafe argument.
+		 * @tparam A The type of the first ThreadSafe argument (const if it must be locked in shared mode).
+		 * @tparam B The type of the second ThreadSafe argument (const if it must be locked in shared mode).
 		 * @param ts1 The first ThreadSafe object whose internal mutex is to be locked.
 		 * @param ts2 The second ThreadSafe object whose internal mutex is to be locked.
-		 * @return A newly constructed anonymous LocksList object, whose internal list contains the unique_lock(s) relative to the the internal mutexes of the arguments.
+		 * @return A newly constructed anonymous LocksList object, whose internal list contains the lock handles relative to the the internal mutexes of the arguments.
 		**/
-	template <typename A, typename B>
-	LocksList operator,(ThreadSafe<A>& ts1, ThreadSafe<B>& ts2) {
-		std::cout << "\x1B[31mThreadSafe ,\033[0m\n"; //DEBUG
-		return LocksList{ts1, ts2};
+	template <ThreadSafeObject A, ThreadSafeObject B>
+	LocksList<2> operator,(A& ts1, B& ts2) {
+		THREAD_SAFE_TRACE(ThreadSafeComma, &ts1);
+		return LocksList<2>{ts1, ts2};
 	}
 
 	/**
 	 * @brief This overload is invoked on a list of comma separated ThreadSafe object, apart from the first pair.
-	 * @tparam A The type of the object wrapped in the ThreadSafe object to lock.
-	 * @param locks The object containing the list of already locked mutexes Uunique_locks(s)).
+	 * @tparam M The number of locks already held by the list.
+	 * @tparam A The type of the ThreadSafe object to lock (const if it must be locked in shared mode).
+	 * @param locks The object containing the list of already locked mutexes (lock handles). Its handles are moved into the returned object.
 	 * @param ts The ThreadSafe object to add to the list of locks.
-	 * @return The locks object with the new lock added to the internal list.
+	 * @return A new locks object holding the locks of the old one plus the new lock.
 	**/
-	template <typename A>
-	LocksList operator,(LocksList locks, ThreadSafe<A>& ts) {
-		std::cout << "\x1B[31mLocksList ,\033[0m\n"; //DEBUG
-		locks.add(ts);
-		return locks;
+	template <std::size_t M, ThreadSafeObject A>
+	LocksList<M + 1> operator,(LocksList<M>&& locks, A& ts) {
+		THREAD_SAFE_TRACE(LocksListComma, &ts);
+		return LocksList<M + 1>{std::move(locks), ts};
 	}
 	///@}
 
+
+
+	/**
+	 * @class LocksGuard
+	 * @brief Keeps some ThreadSafe objects locked for a whole scope, and gives access to their wrapped objects. It is returned by `lock(ts1, ts2, ...)`.
+	 * @details The objects are locked by a LocksList, so they are acquired in a deadlock free way, and the const ones are locked in shared mode (if their mutex supports it).
+	 * The wrapped objects are accessed through `get<I>()` or through structured bindings:
+	 * @code
+	 * auto [from, to] = thread_safe::lock(account1, account2);
+	 * from.balance -= 10;
+	 * to.balance += 10;
+	 * @endcode
+	 * @tparam Objects The types of the ThreadSafe objects (const if they must be locked in shared mode).
+	**/
+	template<ThreadSafeObject... Objects>
+	class LocksGuard {
+		LocksList<sizeof...(Objects)> locks;
+		std::tuple<Objects&...> objects;
+
+		public:
+		//The type of the I-th wrapped object (const if the I-th ThreadSafe object is const).
+		template<std::size_t I>
+		using Element = std::conditional_t<std::is_const_v<std::tuple_element_t<I, std::tuple<Objects...>>>,
+			const std::remove_reference_t<decltype(~std::declval<std::remove_const_t<std::tuple_element_t<I, std::tuple<Objects...>>>&>())>,
+			std::remove_reference_t<decltype(~std::declval<std::remove_const_t<std::tuple_element_t<I, std::tuple<Objects...>>>&>())>>;
+
+		//Locks all of the objects, building a LocksList out of the comma separated list of them.
+		explicit LocksGuard(Objects&... ts) : locks{(..., ts)}, objects{ts...} {
+		}
+
+		//Adopts a list already holding the locks of all of the objects (see tryLock).
+		LocksGuard(LocksList<sizeof...(Objects)>&& locks, Objects&... ts) : locks{std::move(locks)}, objects{ts...} {
+		}
+
+		//Adopts the locks of all of the objects, which have already been locked (see lock_async).
+		static LocksGuard adopt(Objects&... ts) {
+			return LocksGuard{LocksList<sizeof...(Objects)>{std::adopt_lock, ts...}, ts...};
+		}
+
+		//Locks all of the objects only if all of them are free, without waiting. If any of them is busy, none is kept locked.
+		static std::optional<LocksGuard> tryLock(Objects&... ts) {
+			LocksList<sizeof...(Objects)> locks{std::try_to_lock, ts...};
+			if (!locks.ownsAll()) {
+				return std::nullopt;
+			}
+			return std::optional<LocksGuard>{std::in_place, std::move(locks), ts...};
+		}
+
+		LocksGuard(const LocksGuard&) = delete;
+		LocksGuard& operator=(const LocksGuard&) = delete;
+
+		//Returns the object wrapped in the I-th ThreadSafe object.
+		template<std::size_t I>
+		Element<I>& get() {
+			return ~const_cast<std::remove_const_t<std::tuple_element_t<I, std::tuple<Objects...>>>&>(std::get<I>(objects));
+		}
+	};
+
+	/**
+	 * @brief Locks some ThreadSafe objects for a whole scope (see LocksGuard). It is the scoped version of a comma separated list.
+	 * @param ts1 The first object to lock (const if it must be locked in shared mode).
+	 * @param ts2 The second object to lock.
+	 * @param others The other objects to lock.
+	 * @return A LocksGuard giving access to the wrapped objects until it is destroyed.
+	**/
+	template<ThreadSafeObject A, ThreadSafeObject B, ThreadSafeObject... Others>
+	LocksGuard<A, B, Others...> lock(A& ts1, B& ts2, Others&... others) {
+		return LocksGuard<A, B, Others...>{ts1, ts2, others...};
+	}
+
+	/**
+	 * @brief Locks some ThreadSafe objects for a whole scope only if all of them are free, without waiting (all-or-nothing version of lock).
+	 * @details If any object is busy, the locks already taken are released, so a thread which cannot proceed never blocks the others.
+	 * @param ts1 The first object to lock (const if it must be locked in shared mode).
+	 * @param ts2 The second object to lock.
+	 * @param others The other objects to lock.
+	 * @return An optional holding a LocksGuard if all of the objects have been locked, an empty optional otherwise.
+	**/
+	template<ThreadSafeObject A, ThreadSafeObject B, ThreadSafeObject... Others>
+	std::optional<LocksGuard<A, B, Others...>> try_lock(A& ts1, B& ts2, Others&... others) {
+		return LocksGuard<A, B, Others...>::tryLock(ts1, ts2, others...);
+	}
+
+	/**
+	 * @class LocksAwaiter
+	 * @brief Awaitable returned by `lock_async(ts1, ts2, ...)`. It resumes the awaiting coroutine with a LocksGuard once all of the objects have been locked.
+	 * @details The mutexes are acquired one at a time in address order, as the fallback of LocksList does, so coroutines and threads locking the same objects in any order cannot deadlock. While a mutex is busy the awaiter is queued on it, and the acquisition goes on from the thread which hands the mutex over.
+	 * @tparam Objects The types of the ThreadSafe objects, protected by an AsyncMutex.
+	**/
+	template<AsyncThreadSafeObject... Objects>
+	class LocksAwaiter : LockWaiter {
+		//The mutex of one of the objects, with the lock storing it (which records the statistics of the acquisition).
+		struct Entry {
+			AsyncMutex* mutex;
+			void* lock;
+			void (*acquired)(void* lock, bool contended);
+		};
+
+		std::tuple<Objects&...> objects;
+		std::array<Entry, sizeof...(Objects)> entries; //Sorted by address.
+		std::size_t next = 0; //The first entry not yet locked.
+
+		template<AsyncThreadSafeObject A>
+		static Entry entryOf(A& ts) {
+			using Lock = decltype(ts.mtx);
+			return Entry{&asyncMutexOf(ts.mtx), &ts.mtx, [](void* lock, bool contended) { recordAsyncAcquisition(*static_cast<Lock*>(lock), contended); }};
+		}
+
+		//Locks the entries from next on. It returns false if the awaiter has been queued on a busy mutex: the acquisition goes on from wake, when that mutex is handed over.
+		bool lockRemaining() {
+			for (; next < entries.size(); ++next) {
+				if (!entries[next].mutex->lockOrEnqueue(*this)) {
+					return false;
+				}
+				entries[next].acquired(entries[next].lock, false);
+			}
+			return true;
+		}
+
+		public:
+		explicit LocksAwaiter(Objects&... ts) : objects{ts...}, entries{entryOf(ts)...} {
+			std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return std::less<>{}(a.lock, b.lock); });
+			wake = [](LockWaiter* waiter) {
+				auto* self = static_cast<LocksAwaiter*>(waiter);
+				Entry& handedOver = self->entries[self->next++];
+				handedOver.acquired(handedOver.lock, true);
+				if (self->lockRemaining()) {
+					resumeHandedOver(*self);
+				}
+			};
+		}
+
+		bool await_ready() const noexcept {
+			return false;
+		}
+
+		//Suspends the coroutine only if some mutex is busy. Once queued, the awaiter is not touched anymore, since another thread may go on with the acquisition at once.
+		bool await_suspend(std::coroutine_handle<> awaiting) {
+			coroutine = awaiting;
+			return !lockRemaining();
+		}
+
+		LocksGuard<Objects...> await_resume() {
+			return std::apply([](Objects&... ts) { return LocksGuard<Objects...>::adopt(ts...); }, objects);
+		}
+	};
+
+	/**
+	 * @brief Locks some ThreadSafe objects from a coroutine, suspending it (instead of blocking its thread) until all of them have been locked. It is the coroutine version of `lock(ts1, ts2, ...)`:
+	 * @code
+	 * auto [from, to] = co_await thread_safe::lock_async(account1, account2);
+	 * @endcode
+	 * @param ts1 The first object to lock.
+	 * @param ts2 The second object to lock.
+	 * @param others The other objects to lock.
+	 * @return An awaitable resuming the coroutine with a LocksGuard giving access to the wrapped objects.
+	**/
+	template<AsyncThreadSafeObject A, AsyncThreadSafeObject B, AsyncThreadSafeObject... Others>
+	LocksAwaiter<A, B, Others...> lock_async(A& ts1, B& ts2, Others&... others) {
+		return LocksAwaiter<A, B, Others...>{ts1, ts2, others...};
+	}
+
+	//The type (decayed) returned by a Function called with the wrapped objects of Guard (a LocksGuard).
+	template<typename Function, typename Guard, typename Indices>
+	struct LockedResultOf;
+
+	template<typename Function, typename Guard, std::size_t... I>
+	struct LockedResultOf<Function, Guard, std::index_sequence<I...>> {
+		using type = std::decay_t<std::invoke_result_t<Function&, typename Guard::template Element<I>&...>>;
+	};
+
+	//The job run by the WorkerPool for the multi-object forms of post and async: it locks all of the objects through lock, then calls fn with the wrapped objects. It only references the objects, which the caller keeps alive until the job has run.
+	template<typename Function, typename Result, ThreadSafeObject... Objects>
+	struct LockedJob : PoolJob {
+		Function fn;
+		std::tuple<Objects&...> objects;
+		std::optional<std::promise<Result>> promise; //Only used by async.
+
+		template<typename F>
+		LockedJob(F&& fn, Objects&... ts) : fn(std::forward<F>(fn)), objects{ts...} {
+			run = &LockedJob::execute;
+		}
+
+		static void execute(PoolJob* job) {
+			std::unique_ptr<LockedJob> self{static_cast<LockedJob*>(job)};
+			auto guard = std::apply([](auto&... ts) { return lock(ts...); }, self->objects);
+			[&self, &guard]<std::size_t... I>(std::index_sequence<I...>) {
+				if (self->promise) {
+					fulfill(*self->promise, self->fn, guard.template get<I>()...);
+				} else {
+					try {
+						std::invoke(self->fn, guard.template get<I>()...);
+					} catch (...) {
+					}
+				}
+			}(std::index_sequence_for<Objects...>{});
+		}
+	};
+
+	/**
+	 * @brief Queues fn, to be run by the WorkerPool with all of the ThreadSafe objects locked, and returns at once.
+	 * @details The objects are locked as by `lock(ts1, ts2, ...)` (deadlock free, const objects in shared mode) by the worker running fn, which receives the wrapped objects. They do not need to be actors. Exceptions thrown by fn are discarded.
+	 * The job only keeps references to the objects, and their destructors do not wait for it (not even the one of an actor, which only waits for its own queue): the caller must keep all of them alive until fn has run, e.g. by using async and waiting for its future.
+	 * @param fn The operation to run, accepting the wrapped objects in the same order as the ThreadSafe objects.
+	 * @param ts1 The first object to lock.
+	 * @param ts2 The second object to lock.
+	 * @param others The other objects to lock.
+	**/
+	template<typename Function, ThreadSafeObject A, ThreadSafeObject B, ThreadSafeObject... Others>
+	void post(Function&& fn, A& ts1, B& ts2, Others&... others) {
+		WorkerPool::instance().submit(*new LockedJob<std::decay_t<Function>, void, A, B, Others...>{std::forward<Function>(fn), ts1, ts2, others...});
+	}
+
+	/**
+	 * @brief Queues fn like the multi-object form of post, and returns a future which will receive its result (or the exception it throws).
+	 * @details The caller must keep all of the objects alive until the future is ready.
+	 * @param fn The operation to run, accepting the wrapped objects in the same order as the ThreadSafe objects.
+	 * @param ts1 The first object to lock.
+	 * @param ts2 The second object to lock.
+	 * @param others The other objects to lock.
+	 * @return The future result of fn.
+	**/
+	template<typename Function, ThreadSafeObject A, ThreadSafeObject B, ThreadSafeObject... Others>
+	auto async(Function&& fn, A& ts1, B& ts2, Others&... others) {
+		using Result = typename LockedResultOf<std::decay_t<Function>, LocksGuard<A, B, Others...>, std::index_sequence_for<A, B, Others...>>::type;
+		auto* job = new LockedJob<std::decay_t<Function>, Result, A, B, Others...>{std::forward<Function>(fn), ts1, ts2, others...};
+		job->promise.emplace();
+		std::future<Result> result = job->promise->get_future();
+		WorkerPool::instance().submit(*job);
+		return result;
+	}
+
 	
 
 }
 
+//Structured bindings support for LocksGuard.
+template<thread_safe::ThreadSafeObject... Objects>
+struct std::tuple_size<thread_safe::LocksGuard<Objects...>> : std::integral_constant<std::size_t, sizeof...(Objects)> {};
+
+template<std::size_t I, thread_safe::ThreadSafeObject... Objects>
+struct std::tuple_element<I, thread_safe::LocksGuard<Objects...>> {
+	using type = typename thread_safe::LocksGuard<Objects...>::template Element<I>;
+};
+
+#include "AtomicThreadSafe.h"
+#include "ShardedContainers.h"
+#include "ThreadSafeArray.h"
+#include "ThreadSafeQueue.h"
+#include "Transactions.h"
+
 #endif
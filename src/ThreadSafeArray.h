@@ -0,0 +1,169 @@
+#ifndef THREAD_SAFE_ARRAY
+#define THREAD_SAFE_ARRAY
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include "LockPolicies.h"
+#include "CompactLock.h"
+
+//Arrays of protected elements, stored contiguously and locked per element or per stripe of elements. This header is included at the end of ThreadSafe.h.
+namespace thread_safe {
+
+	/**
+	 * @class ThreadSafeArray
+	 * @brief Array of N elements of type T, each one protected by the lock of its stripe: StripeSize consecutive elements share a lock (StripeSize = 1 gives a lock per element).
+	 * @details Each stripe is a ThreadSafe object wrapping StripeSize elements, and the stripes are stored contiguously, so the elements are laid out in index order with the lock of each stripe right before it. The default CompactLock adds a single byte (plus padding) per stripe: `ThreadSafeArray<int, 1024>` takes 8 KiB.
+	 * With a CacheAligned policy each stripe starts on its own cache line, so that threads working on neighbouring stripes do not slow down each other (false sharing).
+	 * Single elements are accessed through lock or apply, which lock only their stripe. for_each_locked walks the whole array in memory order, locking one stripe at a time.
+	 * @tparam T The type of the elements.
+	 * @tparam N The number of elements, or std::dynamic_extent if it is chosen on construction.
+	 * @tparam StripeSize How many consecutive elements share a lock.
+	 * @tparam LockPolicy The lock of each stripe.
+	**/
+	template<typename T, std::size_t N = std::dynamic_extent, std::size_t StripeSize = 1, Lockable LockPolicy = CompactLock>
+	class ThreadSafeArray {
+		static_assert(StripeSize > 0, "A stripe must hold at least one element");
+
+		public:
+		using Stripe = ThreadSafe<std::array<T, StripeSize>, LockPolicy>;
+
+		private:
+		static constexpr std::size_t stripesFor(std::size_t count) {
+			return (count + StripeSize - 1) / StripeSize;
+		}
+
+		using Storage = std::conditional_t<N == std::dynamic_extent, std::unique_ptr<Stripe[]>, std::array<Stripe, stripesFor(N)>>;
+
+		Storage stripes;
+		std::size_t count = N;
+
+		//Keeps the stripe of an element locked for a whole scope, giving access to the element through `->` and `*`, as a Temp object does for a whole ThreadSafe object.
+		template<bool ReadOnly>
+		class BasicElementGuard {
+			using Owner = std::conditional_t<ReadOnly, const Stripe, Stripe>;
+			using Element = std::conditional_t<ReadOnly, const T, T>;
+
+			decltype(std::declval<Owner&>().lock()) stripeGuard;
+			Element* element;
+
+			public:
+			BasicElementGuard(Owner& stripe, std::size_t offset) : stripeGuard{stripe.lock()}, element{&(*stripeGuard)[offset]} {
+			}
+
+			BasicElementGuard(const BasicElementGuard&) = delete;
+			BasicElementGuard& operator=(const BasicElementGuard&) = delete;
+
+			Element* operator->() {
+				return element;
+			}
+
+			Element& operator*() {
+				return *element;
+			}
+		};
+
+		//Calls fn on each element of self (in shared mode if self is const and LockPolicy allows it), stripe by stripe, in memory order.
+		template<typename Self, typename Function>
+		static void forEachLocked(Self& self, Function& fn) {
+			for (std::size_t s = 0, first = 0; first < self.count; ++s, first += StripeSize) {
+				auto guard = self.stripes[s].lock();
+				auto& block = *guard;
+				for (std::size_t i = 0, last = std::min(StripeSize, self.count - first); i < last; ++i) {
+					if constexpr (std::invocable<Function&, std::size_t, decltype(block[i])>) {
+						std::invoke(fn, first + i, block[i]);
+					} else {
+						std::invoke(fn, block[i]);
+					}
+				}
+			}
+		}
+
+
+		public:
+		using ElementGuard = BasicElementGuard<false>; //Guard granting read-write access to an element.
+		using ConstElementGuard = BasicElementGuard<true>; //Guard granting read-only access to an element.
+
+		//Constructs an array of N default constructed elements.
+		ThreadSafeArray() requires (N != std::dynamic_extent) = default;
+
+		//Constructs an array of count default constructed elements.
+		explicit ThreadSafeArray(std::size_t count) requires (N == std::dynamic_extent) : stripes{std::make_unique<Stripe[]>(stripesFor(count))}, count{count} {
+		}
+
+		ThreadSafeArray(const ThreadSafeArray&) = delete;
+		ThreadSafeArray& operator=(const ThreadSafeArray&) = delete;
+
+		std::size_t size() const {
+			return count;
+		}
+
+		/**
+		 * @brief Returns the stripe holding the element at index, e.g. to lock some elements together in a comma separated list.
+		 * @details The element is `(~stripe)[index % StripeSize]` while the stripe is locked.
+		**/
+		Stripe& stripeOf(std::size_t index) {
+			return stripes[index / StripeSize];
+		}
+
+		const Stripe& stripeOf(std::size_t index) const {
+			return stripes[index / StripeSize];
+		}
+
+		/**
+		 * @brief Locks the stripe of the element at index for a whole scope.
+		 * @code
+		 * auto element = array.lock(3);
+		 * element->push_back(1);
+		 * @endcode
+		 * @param index The index of the element.
+		 * @return A guard giving access to the element until it is destroyed.
+		**/
+		ElementGuard lock(std::size_t index) {
+			return ElementGuard{stripeOf(index), index % StripeSize};
+		}
+
+		//Read-only version of lock: if LockPolicy is SharedLockable the stripe is locked in shared mode.
+		ConstElementGuard lock(std::size_t index) const {
+			return ConstElementGuard{stripeOf(index), index % StripeSize};
+		}
+
+		/**
+		 * @brief Runs fn on the element at index with its stripe locked (see ThreadSafe::apply).
+		 * @tparam Function A callable accepting a T&.
+		 * @param index The index of the element.
+		 * @param fn The operation to run.
+		 * @return The value returned by fn (by value).
+		**/
+		template<std::invocable<T&> Function>
+		auto apply(std::size_t index, Function&& fn) {
+			return stripeOf(index).apply([offset = index % StripeSize, &fn](auto& block) { return std::invoke(fn, block[offset]); });
+		}
+
+		/**
+		 * @brief Calls fn on each element, in index (and memory) order, locking one stripe at a time: each lock is taken once for StripeSize elements, and the elements are read sequentially.
+		 * @details The array is not locked as a whole, so other threads can modify the stripes already visited (or not visited yet). fn can access the element being visited through the array too: its stripe is already held by the current thread, so it is not locked again (see HeldLocks).
+		 * @tparam Function A callable accepting either a T& or the index and a T&.
+		 * @param fn The operation to run.
+		**/
+		template<typename Function>
+		void for_each_locked(Function&& fn) {
+			forEachLocked(*this, fn);
+		}
+
+		//Read-only version of for_each_locked: if LockPolicy is SharedLockable the stripes are locked in shared mode.
+		template<typename Function>
+		void for_each_locked(Function&& fn) const {
+			forEachLocked(*this, fn);
+		}
+	};
+
+}
+
+#endif
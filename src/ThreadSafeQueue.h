@@ -0,0 +1,324 @@
+#ifndef THREAD_SAFE_QUEUE
+#define THREAD_SAFE_QUEUE
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include "LockPolicies.h"
+#include "Conditions.h"
+
+//Bounded lock-free queue for producer/consumer pipelines, in place of a ThreadSafe<std::queue<T>> or ThreadSafe<std::deque<T>>. This header is included at the end of ThreadSafe.h.
+namespace thread_safe {
+
+	/**
+	 * @class ThreadSafeQueue
+	 * @brief Bounded multi-producer multi-consumer FIFO queue of T, without any lock: a ring of cells allocated once, each one with a sequence number telling whether it is free or full in the current round (D. Vyukov's bounded MPMC queue).
+	 * @details A producer claims the next free cell by advancing pushPosition with a compare-and-swap, constructs the element in it and publishes it through the sequence number of the cell; consumers do the same with popPosition. The two positions are on their own cache lines, so producers and consumers do not invalidate each other's position, and nothing is allocated after construction.
+	 * push_n and pop_n claim as many consecutive cells as available with a single compare-and-swap, so a batch costs about as much as a single element.
+	 * The try_ operations never wait. The other ones wait while the queue is full (push) or empty (pop): the waiting threads sleep in the ConditionLot, and each operation wakes them up with a single load when nobody is waiting.
+	 * The operations are named as those of std::queue, and `->` gives access to the queue itself, so that code written for a ThreadSafe<std::queue<T>> (e.g. `jobs->push(job)`, `jobs->size()`) works unchanged on a ThreadSafeQueue. Unlike std::queue, pop returns the element: front and pop can not be separate operations, since another consumer could pop in between.
+	 * T must be nothrow move constructible: once a cell has been claimed, the element must be stored in it, otherwise the consumers would wait for it forever. For the same reason push_n constructs the elements from its iterators without throwing (e.g. through a std::move_iterator).
+	 * @tparam T The type of the elements.
+	**/
+	template<typename T>
+	class ThreadSafeQueue {
+		static_assert(std::is_nothrow_move_constructible_v<T> && std::is_nothrow_destructible_v<T>, "The elements of a ThreadSafeQueue must be nothrow move constructible and destructible");
+
+		struct Cell {
+			std::atomic<std::size_t> sequence; //position if the cell is free for the element pushed at position, position + 1 if it holds it.
+			alignas(T) unsigned char storage[sizeof(T)];
+
+			T* element() {
+				return std::launder(reinterpret_cast<T*>(storage));
+			}
+		};
+
+		std::unique_ptr<Cell[]> cells;
+		std::size_t mask; //The capacity, a power of 2, minus 1.
+		alignas(cacheLineSize) std::atomic<std::size_t> pushPosition{0}; //Consumers waiting for an element are parked on its address.
+		alignas(cacheLineSize) std::atomic<std::size_t> popPosition{0}; //Producers waiting for a free cell are parked on its address. The alignment of the class keeps the following objects off its cache line.
+
+		static std::ptrdiff_t distance(std::size_t sequence, std::size_t position) {
+			return static_cast<std::ptrdiff_t>(sequence - position);
+		}
+
+		/**
+		 * @brief Claims up to wanted consecutive cells whose sequence is their position plus offset, by advancing position past them.
+		 * @details Producers claim free cells (offset 0) advancing pushPosition, consumers claim full cells (offset 1) advancing popPosition. A cell which is ready for position p can only be made ready for another position by the thread which claims p, so once the compare-and-swap succeeds the cells checked before it are all owned by the caller.
+		 * @return The position of the first claimed cell, and how many cells have been claimed (0 if the first one is not ready).
+		**/
+		std::pair<std::size_t, std::size_t> claim(std::atomic<std::size_t>& position, std::size_t offset, std::size_t wanted) {
+			wanted = std::min(wanted, mask + 1);
+			std::size_t first = position.load(std::memory_order_relaxed);
+			if (wanted == 0) {
+				return {first, 0};
+			}
+			for (;;) {
+				std::ptrdiff_t d = distance(cells[first & mask].sequence.load(std::memory_order_acquire), first + offset);
+				if (d < 0) {
+					return {first, 0}; //The first cell is still full (or still empty) from the previous round: the queue is full (or empty).
+				}
+				if (d > 0) {
+					first = position.load(std::memory_order_relaxed); //Another thread has claimed first in the meanwhile.
+					continue;
+				}
+				std::size_t claimed = 1;
+				while (claimed < wanted && cells[(first + claimed) & mask].sequence.load(std::memory_order_acquire) == first + claimed + offset) {
+					++claimed;
+				}
+				if (position.compare_exchange_weak(first, first + claimed, std::memory_order_relaxed, std::memory_order_relaxed)) {
+					return {first, claimed};
+				}
+			}
+		}
+
+		//Wakes up the threads parked on address after some cells have been published: one thread per cell, so that pushing a single element does not wake up all of the consumers.
+		static void wakeUp(const void* address, std::size_t cellCount) {
+			std::atomic_thread_fence(std::memory_order_seq_cst); //Orders the publication of the cells before the check of the waiters (see ConditionLot::mayHaveParked).
+			if (!ConditionLot::mayHaveParked(address)) {
+				return;
+			}
+			if (cellCount == 1) {
+				ConditionLot::unparkOne(address, [](bool, bool) {});
+			} else {
+				ConditionLot::unparkAll(address);
+			}
+		}
+
+		//Whether the next cell of position is not ready yet (the queue is full for producers, or empty for consumers).
+		bool mustWait(const std::atomic<std::size_t>& position, std::size_t offset) const {
+			std::size_t first = position.load(std::memory_order_relaxed);
+			return distance(cells[first & mask].sequence.load(std::memory_order_acquire), first + offset) < 0;
+		}
+
+		//Claims up to wanted free cells and stores in them the elements made by make (called with the index of each element in the batch), returning how many have been stored.
+		template<typename Make>
+		std::size_t pushClaimed(std::size_t wanted, Make&& make) {
+			auto [first, claimed] = claim(pushPosition, 0, wanted);
+			for (std::size_t i = 0; i < claimed; ++i) {
+				Cell& cell = cells[(first + i) & mask];
+				::new (static_cast<void*>(cell.storage)) T(make(i));
+				cell.sequence.store(first + i + 1, std::memory_order_release);
+			}
+			if (claimed > 0) {
+				wakeUp(&pushPosition, claimed);
+			}
+			return claimed;
+		}
+
+		//Destroys the element of the cell claimed at position and frees the cell for the producers of the next round.
+		void release(std::size_t position) {
+			Cell& cell = cells[position & mask];
+			cell.element()->~T();
+			cell.sequence.store(position + mask + 1, std::memory_order_release);
+		}
+
+		//Claims up to wanted full cells and passes their elements (as rvalues) to take, returning how many have been taken.
+		//If take throws, the claimed cells are freed anyway (destroying the elements not taken yet) before the exception is propagated: otherwise the producers would find them full forever.
+		template<typename Take>
+		std::size_t popClaimed(std::size_t wanted, Take&& take) {
+			auto [first, claimed] = claim(popPosition, 1, wanted);
+			std::size_t i = 0;
+			try {
+				for (; i < claimed; ++i) {
+					take(std::move(*cells[(first + i) & mask].element()));
+					release(first + i);
+				}
+			} catch (...) {
+				for (; i < claimed; ++i) {
+					release(first + i);
+				}
+				wakeUp(&popPosition, claimed);
+				throw;
+			}
+			if (claimed > 0) {
+				wakeUp(&popPosition, claimed);
+			}
+			return claimed;
+		}
+
+		//Waits until the queue is not full, parked on popPosition.
+		void waitForFreeCell() {
+			ConditionLot::park(&popPosition, [this]() { return mustWait(pushPosition, 0); });
+		}
+
+		//Waits until the queue is not empty, parked on pushPosition.
+		void waitForElement() {
+			ConditionLot::park(&pushPosition, [this]() { return mustWait(popPosition, 1); });
+		}
+
+		//Appends up to count elements constructed from first, advancing it past them.
+		template<typename Iterator>
+		std::size_t pushFrom(Iterator& first, std::size_t count) {
+			static_assert(std::is_nothrow_constructible_v<T, std::iter_reference_t<Iterator>>, "push_n needs elements which can be constructed without throwing: pass a std::move_iterator");
+			return pushClaimed(count, [&first](std::size_t) -> std::iter_reference_t<Iterator> {
+				if constexpr (std::is_reference_v<std::iter_reference_t<Iterator>>) {
+					return *first++;
+				} else {
+					std::iter_reference_t<Iterator> element = *first;
+					++first;
+					return element;
+				}
+			});
+		}
+
+
+		public:
+		/**
+		 * @brief Constructs an empty queue, allocating all of its cells.
+		 * @param capacity The maximum number of elements, rounded up to a power of 2.
+		**/
+		explicit ThreadSafeQueue(std::size_t capacity) : cells{std::make_unique<Cell[]>(std::bit_ceil(std::max<std::size_t>(capacity, 2)))}, mask{std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1} {
+			for (std::size_t i = 0; i <= mask; ++i) {
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		ThreadSafeQueue(const ThreadSafeQueue&) = delete;
+		ThreadSafeQueue& operator=(const ThreadSafeQueue&) = delete;
+
+		//Destroys the elements still in the queue. No thread must be using it.
+		~ThreadSafeQueue() {
+			while (popClaimed(mask + 1, [](T&&) {}) > 0) {
+			}
+		}
+
+		//Gives access to the queue itself, so that `queue->push(x)`, written for a ThreadSafe<std::queue<T>>, works on a ThreadSafeQueue too.
+		ThreadSafeQueue* operator->() {
+			return this;
+		}
+
+		const ThreadSafeQueue* operator->() const {
+			return this;
+		}
+
+		/**
+		 * @brief Appends an element constructed from args, if the queue is not full.
+		 * @details The element is constructed before claiming a cell, so a throwing constructor leaves the queue unchanged.
+		 * @return Whether the element has been appended.
+		**/
+		template<typename... ArgsType>
+		bool try_emplace(ArgsType&&... args) {
+			T element(std::forward<ArgsType>(args)...);
+			return pushClaimed(1, [&element](std::size_t) -> T&& { return std::move(element); }) == 1;
+		}
+
+		template<typename U = T>
+		bool try_push(U&& value) {
+			return try_emplace(std::forward<U>(value));
+		}
+
+		//Appends an element constructed from args, waiting while the queue is full.
+		template<typename... ArgsType>
+		void emplace(ArgsType&&... args) {
+			T element(std::forward<ArgsType>(args)...);
+			while (pushClaimed(1, [&element](std::size_t) -> T&& { return std::move(element); }) == 0) {
+				waitForFreeCell();
+			}
+		}
+
+		template<typename U = T>
+		void push(U&& value) {
+			emplace(std::forward<U>(value));
+		}
+
+		/**
+		 * @brief Removes the first element, if the queue is not empty.
+		 * @return The element, or an empty optional if the queue is empty.
+		**/
+		std::optional<T> try_pop() {
+			std::optional<T> element;
+			popClaimed(1, [&element](T&& e) { element.emplace(std::move(e)); });
+			return element;
+		}
+
+		//Removes the first element, waiting while the queue is empty.
+		T pop() {
+			for (;;) {
+				if (std::optional<T> element = try_pop()) {
+					return std::move(*element);
+				}
+				waitForElement();
+			}
+		}
+
+		/**
+		 * @brief Appends up to count elements constructed from first, first + 1... in order, without waiting.
+		 * @details They are appended with a single compare-and-swap, as long as the queue has free cells: the elements are consecutive in the queue, unless another producer appends between two calls.
+		 * @tparam Iterator An input iterator whose elements T can be constructed from without throwing (e.g. a std::move_iterator).
+		 * @return How many elements have been appended: the following ones have not been read.
+		**/
+		template<std::input_iterator Iterator>
+		std::size_t try_push_n(Iterator first, std::size_t count) {
+			return pushFrom(first, count);
+		}
+
+		//Appends count elements constructed from first, first + 1... (see try_push_n), waiting for free cells while the queue is full.
+		template<std::input_iterator Iterator>
+		void push_n(Iterator first, std::size_t count) {
+			while (count > 0) {
+				std::size_t pushed = pushFrom(first, count);
+				count -= pushed;
+				if (pushed == 0) {
+					waitForFreeCell();
+				}
+			}
+		}
+
+		/**
+		 * @brief Removes up to max elements with a single compare-and-swap, without waiting.
+		 * @details If moving an element to out throws (e.g. a std::back_inserter failing to allocate), the exception is propagated, and the elements removed by the call and not moved yet are destroyed: the queue stays usable.
+		 * @tparam OutputIterator An output iterator the elements are moved to, in order.
+		 * @param out Where the elements are moved.
+		 * @param max The maximum number of elements to remove.
+		 * @return How many elements have been removed (0 if the queue is empty).
+		**/
+		template<typename OutputIterator>
+		std::size_t try_pop_n(OutputIterator out, std::size_t max) {
+			return popClaimed(max, [&out](T&& element) { *out = std::move(element); ++out; });
+		}
+
+		//Removes up to max elements (see try_pop_n), waiting while the queue is empty: it returns as soon as at least one has been removed.
+		template<typename OutputIterator>
+		std::size_t pop_n(OutputIterator out, std::size_t max) {
+			for (;;) {
+				if (std::size_t popped = try_pop_n(out, max); popped > 0 || max == 0) {
+					return popped;
+				}
+				waitForElement();
+			}
+		}
+
+		//The number of elements, which other threads may change at any time. Elements being pushed or popped are counted.
+		std::size_t size() const {
+			std::size_t popped = popPosition.load(std::memory_order_acquire);
+			std::size_t pushed = pushPosition.load(std::memory_order_acquire);
+			return pushed - popped <= mask + 1 ? pushed - popped : 0;
+		}
+
+		bool empty() const {
+			return size() == 0;
+		}
+
+		std::size_t capacity() const {
+			return mask + 1;
+		}
+
+		//It does nothing: there is no lock, so there is no contention to record.
+		void registerAs([[maybe_unused]] std::string_view name) {
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef THREAD_SAFE_TRACING
+#define THREAD_SAFE_TRACING
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+//Tracers which can be selected through THREAD_SAFE_TRACER to record the operations performed on ThreadSafe objects. This header is only included if THREAD_SAFE_TRACER is defined.
+//A tracer is any type with a static `record(TraceEvent, const void* object)` function.
+namespace thread_safe {
+
+	//The operations which can be traced. The object associated to each event is the ThreadSafe object involved, or the LocksList for LocksListArrowStar.
+	enum class TraceEvent : std::uint8_t {
+		ThreadSafeCtor,
+		ThreadSafeCopyCtor,
+		ThreadSafeCopyAssign,
+		ThreadSafeMoveCtor,
+		ThreadSafeMoveAssign,
+		ThreadSafeArrow,
+		ThreadSafeConstArrow,
+		ThreadSafeDereference,
+		ThreadSafeConstDereference,
+		ThreadSafeTilde,
+		ThreadSafeComma,
+		ThreadSafeUpdate,
+		ThreadSafeApply,
+		ThreadSafeTryAccess,
+		ThreadSafePost,
+		ThreadSafeLockAsync,
+		ThreadSafeWait,
+		LocksListComma,
+		LocksListArrowStar,
+		TempCtor,
+		TempDtor,
+		TempArrow,
+		TempDereference,
+		TempCast,
+		TempArrowStar
+	};
+
+	constexpr const char* traceEventName(TraceEvent event) {
+		switch (event) {
+			case TraceEvent::ThreadSafeCtor: return "ThreadSafe ctor";
+			case TraceEvent::ThreadSafeCopyCtor: return "ThreadSafe copy ctor";
+			case TraceEvent::ThreadSafeCopyAssign: return "ThreadSafe copy =";
+			case TraceEvent::ThreadSafeMoveCtor: return "ThreadSafe move ctor";
+			case TraceEvent::ThreadSafeMoveAssign: return "ThreadSafe move =";
+			case TraceEvent::ThreadSafeArrow: return "ThreadSafe ->";
+			case TraceEvent::ThreadSafeConstArrow: return "ThreadSafe -> const";
+			case TraceEvent::ThreadSafeDereference: return "ThreadSafe *";
+			case TraceEvent::ThreadSafeConstDereference: return "ThreadSafe * const";
+			case TraceEvent::ThreadSafeTilde: return "ThreadSafe ~";
+			case TraceEvent::ThreadSafeComma: return "ThreadSafe ,";
+			case TraceEvent::ThreadSafeUpdate: return "ThreadSafe update";
+			case TraceEvent::ThreadSafeApply: return "ThreadSafe apply";
+			case TraceEvent::ThreadSafeTryAccess: return "ThreadSafe try access";
+			case TraceEvent::ThreadSafePost: return "ThreadSafe post";
+			case TraceEvent::ThreadSafeLockAsync: return "ThreadSafe lock async";
+			case TraceEvent::ThreadSafeWait: return "ThreadSafe wait";
+			case TraceEvent::LocksListComma: return "LocksList ,";
+			case TraceEvent::LocksListArrowStar: return "LocksList ->*";
+			case TraceEvent::TempCtor: return "Temp ctor";
+			case TraceEvent::TempDtor: return "Temp dtor";
+			case TraceEvent::TempArrow: return "Temp ->";
+			case TraceEvent::TempDereference: return "Temp *";
+			case TraceEvent::TempCast: return "Temp cast";
+			case TraceEvent::TempArrowStar: return "Temp ->*";
+		}
+		return "?";
+	}
+
+	//Prints each event on std::cout as soon as it happens. The writes are serialized by the stream, so it is only meant to follow the calls made by a few statements while debugging.
+	struct ConsoleTracer {
+		static void record(TraceEvent event, const void* object) {
+			std::cout << "\x1B[36m" << traceEventName(event) << "\033[0m " << object << "\n";
+		}
+	};
+
+	/**
+	 * @class RingBufferTracer
+	 * @brief Records each event in a ring buffer owned by the calling thread, so that tracing never makes threads synchronize with each other.
+	 * @details Each thread writes its last `capacity` events in its own buffer, without locks or atomic read-modify-write operations. The buffer is taken (under a mutex) only the first time a thread records an event, and it survives the thread, so the whole run can be dumped at the end.
+	 * When a thread exits its buffer is kept with its events, until another thread starts recording and takes it over (discarding them): there are never more buffers than threads recording at the same time, even if threads are continuously created (e.g. by std::async).
+	 * dump and clear must be called when the traced threads are not recording (e.g. after they have been joined).
+	**/
+	class RingBufferTracer {
+		static constexpr std::size_t capacity = 1 << 14;
+
+		struct Record {
+			std::chrono::steady_clock::rep timestamp;
+			TraceEvent event;
+			const void* object;
+		};
+
+		struct Buffer {
+			std::thread::id thread = std::this_thread::get_id(); //The thread which recorded the events. Guarded by the mutex of the registry.
+			bool active = true; //Whether the thread is still running. Guarded by the mutex of the registry.
+			std::array<Record, capacity> records;
+			std::atomic<std::uint64_t> written{0}; //How many records have been written since the last clear (only the last `capacity` are kept).
+		};
+
+		struct Registry {
+			std::mutex mtx;
+			std::vector<std::shared_ptr<Buffer>> buffers;
+		};
+
+		static Registry& registry() {
+			static Registry instance;
+			return instance;
+		}
+
+		//Takes over the buffer of a thread which exited or, if there is none, registers a new one.
+		static std::shared_ptr<Buffer> acquireBuffer() {
+			Registry& r = registry();
+			std::lock_guard guard{r.mtx};
+			for (auto& buffer : r.buffers) {
+				if (!buffer->active) {
+					buffer->active = true;
+					buffer->thread = std::this_thread::get_id();
+					buffer->written.store(0, std::memory_order_relaxed);
+					return buffer;
+				}
+			}
+			return r.buffers.emplace_back(std::make_shared<Buffer>());
+		}
+
+		//Owns the buffer of a thread for the whole life of the thread.
+		struct Owner {
+			std::shared_ptr<Buffer> buffer = acquireBuffer();
+
+			~Owner() {
+				Registry& r = registry();
+				std::lock_guard guard{r.mtx};
+				buffer->active = false;
+			}
+		};
+
+		static Buffer& localBuffer() {
+			thread_local Owner owner;
+			return *owner.buffer;
+		}
+
+		public:
+		static void record(TraceEvent event, const void* object) {
+			Buffer& buffer = localBuffer();
+			std::uint64_t index = buffer.written.load(std::memory_order_relaxed);
+			buffer.records[index % capacity] = {std::chrono::steady_clock::now().time_since_epoch().count(), event, object};
+			buffer.written.store(index + 1, std::memory_order_release);
+		}
+
+		//Prints the recorded events, thread by thread, one per line: thread id, timestamp, event, object.
+		static void dump(std::ostream& out) {
+			Registry& r = registry();
+			std::lock_guard guard{r.mtx};
+			for (auto& buffer : r.buffers) {
+				std::uint64_t written = buffer->written.load(std::memory_order_acquire);
+				for (std::uint64_t i = written > capacity ? written - capacity : 0; i < written; ++i) {
+					const Record& rec = buffer->records[i % capacity];
+					out << buffer->thread << "\t" << rec.timestamp << "\t" << traceEventName(rec.event) << "\t" << rec.object << "\n";
+				}
+			}
+		}
+
+		//Discards all of the recorded events.
+		static void clear() {
+			Registry& r = registry();
+			std::lock_guard guard{r.mtx};
+			for (auto& buffer : r.buffers) {
+				buffer->written.store(0, std::memory_order_relaxed);
+			}
+		}
+	};
+
+}
+
+#endif
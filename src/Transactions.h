@@ -0,0 +1,133 @@
+#ifndef THREAD_SAFE_TRANSACTIONS
+#define THREAD_SAFE_TRANSACTIONS
+
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "LockPolicies.h"
+
+//Optimistic transactions on some ThreadSafe objects: they run on private copies of the objects, without holding any lock, and are committed only if no other thread wrote the objects in the meanwhile. This header is included at the end of ThreadSafe.h.
+namespace thread_safe {
+
+	//How many times atomically runs a transaction on copies of the objects before giving up and running it with all of the objects locked.
+	inline constexpr unsigned defaultOptimisticAttempts = 4;
+
+	//A (possibly const) ThreadSafe object whose lock keeps the version of the wrapped object (e.g. a Versioned policy), so that it can take part in atomically.
+	template<typename T>
+	concept VersionedThreadSafeObject = ThreadSafeObject<T> && requires(const T& ts) {
+		{ ts.version() } -> std::same_as<std::uint64_t>;
+	};
+
+	/**
+	 * @class TransactionEntry
+	 * @brief One of the objects of a transaction run by atomically: the private copy of its wrapped object the transaction works on, and the version the copy was taken at.
+	 * @tparam Object The type of the ThreadSafe object (const if the transaction only reads it).
+	**/
+	template<VersionedThreadSafeObject Object>
+	class TransactionEntry {
+		using Wrapped = std::remove_reference_t<decltype(~std::declval<std::remove_const_t<Object>&>())>;
+
+		Object& ts;
+		std::optional<Wrapped> copy;
+		std::uint64_t version = 0;
+
+		public:
+		explicit TransactionEntry(Object& ts) : ts{ts} {
+		}
+
+		//Copies the wrapped object, locking it in shared mode: concurrent transactions reading the same object do not change its version.
+		void read() {
+			auto guard = std::as_const(ts).lock();
+			version = ts.version();
+			copy.emplace(*guard);
+		}
+
+		//The copy the transaction works on (const if the object is const).
+		std::conditional_t<std::is_const_v<Object>, const Wrapped&, Wrapped&> get() {
+			return *copy;
+		}
+
+		//Whether the object has not been written since read. The caller must hold it.
+		bool unchanged() const {
+			return ts.version() == version;
+		}
+
+		//Replaces the wrapped object (accessed through held, a reference obtained while holding it) with the copy, unless the object is const.
+		template<typename Held>
+		void commit(Held& held) {
+			if constexpr (!std::is_const_v<Object>) {
+				held = std::move(*copy);
+			}
+		}
+
+		//Leaves the object (which the caller holds) unwritten, so that releasing it does not change its version and make the other transactions reading it fail.
+		void abort() {
+			if constexpr (!std::is_const_v<Object>) {
+				ts.keepVersion();
+			}
+		}
+	};
+
+	/**
+	 * @brief Runs fn on some ThreadSafe objects as a single atomic transaction, optimistically: it runs on private copies of the objects without holding any lock, and the copies replace the objects only if no other thread wrote them in the meanwhile.
+	 * @details Each attempt copies the objects (locking each one in shared mode only for the copy), runs fn on the copies, then locks all of the objects (as `lock(ts1, ts2, ...)` does) and checks their versions: if none changed, the copies of the non-const objects are moved into them, otherwise the copies are discarded (leaving all of the versions unchanged) and the transaction is retried.
+	 * While the objects are locked only for copying and committing, transactions on overlapping sets of objects run in parallel and only retry when they actually conflict, while comma separated lists on the same objects serialize for the whole operation.
+	 * After Attempts failed attempts the transaction is run once more with all of the objects locked for its whole duration, directly on the wrapped objects, so a transaction always ends even if it keeps conflicting.
+	 * Since it may run many times, fn should have no effect other than on its arguments. An attempt may also run on copies taken at different times, which never existed together: if fn throws, its exception is propagated (and the copies discarded) even if the attempt would have failed anyway.
+	 * @code
+	 * thread_safe::ThreadSafe<Account, thread_safe::Versioned<>> from, to;
+	 * thread_safe::atomically([](Account& a, Account& b) { a.balance -= 10; b.balance += 10; }, from, to);
+	 * @endcode
+	 * @tparam Attempts How many times the transaction is run optimistically before locking.
+	 * @param fn The transaction, accepting the wrapped objects in the same order as the ThreadSafe objects (const ones for the const objects).
+	 * @param ts1 The first object.
+	 * @param ts2 The second object.
+	 * @param others The other objects.
+	 * @return The value returned by fn (by value) in the attempt which has been committed.
+	**/
+	template<unsigned Attempts = defaultOptimisticAttempts, typename Function, VersionedThreadSafeObject A, VersionedThreadSafeObject B, VersionedThreadSafeObject... Others>
+	auto atomically(Function&& fn, A& ts1, B& ts2, Others&... others) {
+		using Result = typename LockedResultOf<std::decay_t<Function>, LocksGuard<A, B, Others...>, std::index_sequence_for<A, B, Others...>>::type;
+		constexpr auto indices = std::index_sequence_for<A, B, Others...>{};
+
+		for (unsigned attempt = 0; attempt < Attempts; ++attempt) {
+			std::tuple<TransactionEntry<A>, TransactionEntry<B>, TransactionEntry<Others>...> entries{TransactionEntry<A>{ts1}, TransactionEntry<B>{ts2}, TransactionEntry<Others>{others}...};
+			std::apply([](auto&... entry) { (entry.read(), ...); }, entries);
+
+			//Locks all of the objects and commits the copies if no object has changed, returning whether the transaction has been committed. An aborted commit leaves the versions unchanged.
+			auto tryCommit = [&]<std::size_t... I>(std::index_sequence<I...>) {
+				auto guard = lock(ts1, ts2, others...);
+				if (!(std::get<I>(entries).unchanged() && ...)) {
+					(std::get<I>(entries).abort(), ...);
+					return false;
+				}
+				(std::get<I>(entries).commit(guard.template get<I>()), ...);
+				return true;
+			};
+
+			if constexpr (std::is_void_v<Result>) {
+				std::apply([&fn](auto&... entry) { std::invoke(fn, entry.get()...); }, entries);
+				if (tryCommit(indices)) {
+					return;
+				}
+			} else {
+				Result result = std::apply([&fn](auto&... entry) -> Result { return std::invoke(fn, entry.get()...); }, entries);
+				if (tryCommit(indices)) {
+					return result;
+				}
+			}
+		}
+
+		auto guard = lock(ts1, ts2, others...);
+		return [&fn, &guard]<std::size_t... I>(std::index_sequence<I...>) -> Result {
+			return std::invoke(fn, guard.template get<I>()...);
+		}(indices);
+	}
+
+}
+
+#endif
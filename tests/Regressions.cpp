@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ThreadSafe.h"
+#include "CopyOnWrite.h"
+#include "Tracing.h"
+
+//Regression tests: each one checks, deterministically, a behaviour which has been broken before. A test is a function returning whether it passed; the results are printed one per line, and the exit code is the number of failed tests.
+
+namespace {
+
+    //A coroutine handed an AsyncMutex over is resumed on the thread releasing it, inside the destructor of its Temp object: it must not inherit the locks the thread is still holding.
+    thread_safe::TestScheduler::Task probeHeldLocks(thread_safe::AsyncThreadSafe<int>& shared, thread_safe::ThreadSafe<int, thread_safe::SpinLock>& held, bool& reentered) {
+        auto guard = co_await shared.lock_async();
+        reentered = held.try_access().has_value();
+    }
+
+    bool resumedCoroutineDoesNotInheritHeldLocks() {
+        thread_safe::AsyncThreadSafe<int> shared{0};
+        thread_safe::ThreadSafe<int, thread_safe::SpinLock> held{0};
+        bool reentered = true;
+        thread_safe::TestScheduler scheduler;
+        auto outer = held.lock();
+        {
+            auto busy = shared.lock();
+            scheduler.spawn(probeHeldLocks(shared, held, reentered));
+            scheduler.run(); //The coroutine waits for the mutex of shared.
+        } //Releasing shared resumes the coroutine here, while held is still locked by this thread.
+        return !reentered;
+    }
+
+    //A mutex counting the failed attempts to lock one of them, so that a test can tell when another thread is waiting for it. The tests run one at a time, so a single counter is enough.
+    class ProbeMutex : public std::mutex {
+        static inline std::atomic<int> failed{0};
+
+        public:
+        bool try_lock() {
+            bool locked = std::mutex::try_lock();
+            if (!locked) {
+                failed.fetch_add(1);
+            }
+            return locked;
+        }
+
+        //Waits until count attempts have failed since the last call.
+        static void waitForFailedAttempts(int count) {
+            while (failed.load() < count) {
+                std::this_thread::yield();
+            }
+            failed.fetch_sub(count);
+        }
+    };
+
+    //An operation run through apply can access its object again, both when its own thread runs it and when a combiner runs it on behalf of a waiting thread.
+    bool combinedOperationReentersObject() {
+        thread_safe::ThreadSafe<std::vector<int>, thread_safe::BasicFlatCombining<ProbeMutex>> values{};
+        thread_safe::ThreadSafe<int, thread_safe::SpinLock> other{3};
+        values.apply([&](std::vector<int>& v) { v.push_back(1); values->push_back(2); });
+
+        std::thread submitter;
+        values.apply([&](std::vector<int>& v) { //This thread is the combiner, and runs the operation of the submitter once this one returns.
+            submitter = std::thread{[&]() {
+                auto held = other.lock();
+                values.apply([&](std::vector<int>& w) {
+                    auto reentered = other.try_access(); //Held by the submitter, even if this thread is the combiner.
+                    w.push_back(reentered ? **reentered : -1);
+                    values->push_back(4);
+                });
+            }};
+            ProbeMutex::waitForFailedAttempts(2); //The submitter tries the lock before and after publishing its operation.
+            v.push_back(5);
+        });
+        submitter.join();
+        return *values.lock() == std::vector<int>{1, 2, 5, 3, 4};
+    }
+
+    //Waiting on an object the thread already holds returns at once if the predicate holds, and throws if it does not, since nobody else could make it hold.
+    bool waitOnHeldObjectChecksPredicate() {
+        thread_safe::ThreadSafe<std::string> value{"ready"};
+        auto held = value.lock();
+        auto satisfied = value.wait_until([](const std::string& v) { return v == "ready"; });
+        try {
+            auto never = value.wait_until([](const std::string& v) { return v.empty(); });
+        } catch (const std::system_error& e) {
+            return *satisfied == "ready" && e.code() == std::errc::resource_deadlock_would_occur;
+        }
+        return false;
+    }
+
+    //A transaction whose commit is aborted, because another object changed, must not change the version of the objects it locked for the commit: that would make the other transactions reading them fail too.
+    bool abortedCommitKeepsVersions() {
+        thread_safe::ThreadSafe<std::vector<int>, thread_safe::Versioned<>> first{};
+        thread_safe::ThreadSafe<std::vector<int>, thread_safe::Versioned<>> second{};
+        std::uint64_t before = first.version();
+        int calls = 0;
+        bool kept = false;
+        thread_safe::atomically<1>([&](std::vector<int>& f, std::vector<int>& s) {
+            if (calls++ == 0) {
+                second.lock()->push_back(0); //Makes the optimistic attempt fail.
+            } else {
+                kept = first.version() == before; //Run with both objects locked, after the aborted commit.
+            }
+            f.push_back(1);
+            s.push_back(1);
+        }, first, second);
+        return calls == 2 && kept && first.version() == before + 1;
+    }
+
+    //An operation posted to an actor is run by a worker holding the object, so it can access the object again.
+    bool postedOperationReentersObject() {
+        thread_safe::ThreadSafe<std::vector<int>, thread_safe::Actor> values{};
+        std::future<std::size_t> size = values.async([&](std::vector<int>& v) {
+            v.push_back(1);
+            return values->size();
+        });
+        return size.wait_for(std::chrono::seconds{10}) == std::future_status::ready && size.get() == 1;
+    }
+
+    //Counts its living copies, to observe when the versions of a copy-on-write object are reclaimed.
+    struct Counted {
+        int* alive;
+
+        explicit Counted(int* alive) : alive{alive} { ++*alive; }
+        Counted(const Counted& other) : alive{other.alive} { ++*alive; }
+        ~Counted() { --*alive; }
+    };
+
+    //A replaced version of a copy-on-write object is reclaimed when its last Snapshot is destroyed, not at the next update.
+    bool lastSnapshotReclaimsVersion() {
+        int alive = 0;
+        thread_safe::CopyOnWriteThreadSafe<Counted> object{&alive};
+        bool keptWhileRead = false;
+        {
+            auto snapshot = *object;
+            auto moved = std::move(snapshot);
+            object.update([](Counted&) {});
+            keptWhileRead = alive == 2;
+        }
+        return keptWhileRead && alive == 1;
+    }
+
+    //~ on a lock-free object gives the locked value only while the thread holds the lock: otherwise a write would be lost, so it throws in every build.
+    bool tildeOnLockFreeObjectNeedsLock() {
+        thread_safe::ThreadSafe<int> counter{0};
+        try {
+            ~counter = 5;
+            return false;
+        } catch (const std::system_error& e) {
+            if (e.code() != std::errc::operation_not_permitted) {
+                return false;
+            }
+        }
+        {
+            auto held = counter.lock();
+            ~counter = 5;
+        }
+        return *counter == 5;
+    }
+
+    //The trace buffer of an exited thread is taken over by the next thread which records an event, so creating threads does not grow the memory of the tracer.
+    bool exitedThreadsReuseTraceBuffers() {
+        thread_safe::RingBufferTracer::clear();
+        for (int i = 0; i < 8; ++i) {
+            std::thread{[]() { thread_safe::RingBufferTracer::record(thread_safe::TraceEvent::TempCtor, nullptr); }}.join();
+        }
+        std::ostringstream out;
+        thread_safe::RingBufferTracer::dump(out);
+        std::string dumped = out.str();
+        return std::count(dumped.begin(), dumped.end(), '\n') == 1;
+    }
+
+    //An output iterator which throws after accepting a given number of elements.
+    struct FailingOutput {
+        using difference_type = std::ptrdiff_t;
+
+        int* accepted;
+        int limit;
+
+        FailingOutput& operator*() { return *this; }
+        FailingOutput& operator++() { return *this; }
+        FailingOutput operator++(int) { return *this; }
+
+        FailingOutput& operator=(int) {
+            if (*accepted == limit) {
+                throw std::bad_alloc{};
+            }
+            ++*accepted;
+            return *this;
+        }
+    };
+
+    //If moving the popped elements out throws, the cells claimed by pop_n are freed anyway: the producers must not see the queue full forever.
+    bool failedPopFreesClaimedCells() {
+        thread_safe::ThreadSafeQueue<int> queue{4};
+        int values[] = {1, 2, 3, 4};
+        queue.push_n(values, 4);
+        int accepted = 0;
+        try {
+            queue.try_pop_n(FailingOutput{&accepted, 2}, 4);
+            return false;
+        } catch (const std::bad_alloc&) {
+        }
+        return accepted == 2 && queue.empty() && queue.try_push_n(values, 4) == 4;
+    }
+
+}
+
+int main() {
+    std::pair<std::string_view, std::function<bool()>> tests[] = {
+        {"resumed_coroutine_does_not_inherit_held_locks", resumedCoroutineDoesNotInheritHeldLocks},
+        {"combined_operation_reenters_object", combinedOperationReentersObject},
+        {"wait_on_held_object_checks_predicate", waitOnHeldObjectChecksPredicate},
+        {"aborted_commit_keeps_versions", abortedCommitKeepsVersions},
+        {"posted_operation_reenters_object", postedOperationReentersObject},
+        {"last_snapshot_reclaims_version", lastSnapshotReclaimsVersion},
+        {"tilde_on_lock_free_object_needs_lock", tildeOnLockFreeObjectNeedsLock},
+        {"exited_threads_reuse_trace_buffers", exitedThreadsReuseTraceBuffers},
+        {"failed_pop_frees_claimed_cells", failedPopFreesClaimedCells},
+    };
+
+    int failed = 0;
+    for (auto& [name, test] : tests) {
+        bool ok = test();
+        std::cout << (ok ? "ok     " : "FAILED ") << name << std::endl;
+        failed += ok ? 0 : 1;
+    }
+    return failed;
+}
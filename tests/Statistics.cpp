@@ -0,0 +1,138 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#define THREAD_SAFE_STATISTICS 1
+#include "ThreadSafe.h"
+
+//Checks of the contention statistics (THREAD_SAFE_STATISTICS), laid out as the regression tests: each check is a function returning whether it passed, and the exit code is the number of failed checks.
+
+namespace {
+
+    //A timed mutex telling when an attempt to lock one of them fails, so that a check can release it only once another thread is waiting for it. The checks run one at a time, so a single flag is enough.
+    class ProbeLock : public std::timed_mutex {
+        static inline std::atomic<bool> failed{false};
+
+        public:
+        bool try_lock() {
+            bool locked = std::timed_mutex::try_lock();
+            if (!locked) {
+                failed.store(true);
+            }
+            return locked;
+        }
+
+        //Waits until an attempt has failed since the last call.
+        static void waitForFailedAttempt() {
+            while (!failed.exchange(false)) {
+                std::this_thread::yield();
+            }
+        }
+    };
+
+    using Probed = thread_safe::ThreadSafe<std::vector<int>, ProbeLock>;
+
+    //The uncontended accesses are counted, and each exclusive one records its hold time.
+    bool countsAcquisitions() {
+        Probed values{};
+        values->push_back(1);
+        values->push_back(2);
+        const auto& stats = values.statistics();
+        return stats.acquisitions == 2 && stats.contendedAcquisitions == 0 && stats.holdTime.count() == 2 && stats.waitTime.count() == 0;
+    }
+
+    //An access which finds the object locked by another thread is counted as contended, and its wait is recorded.
+    bool countsContendedAcquisitions() {
+        Probed values{};
+        std::thread waiter;
+        {
+            auto held = values.lock();
+            waiter = std::thread{[&values]() { values->push_back(1); }};
+            ProbeLock::waitForFailedAttempt();
+        }
+        waiter.join();
+        const auto& stats = values.statistics();
+        return stats.acquisitions == 2 && stats.contendedAcquisitions == 1 && stats.waitTime.count() == 1 && stats.holdTime.count() == 2;
+    }
+
+    //A timed access which gets the object after waiting is counted as contended, while one which times out is not counted at all.
+    bool countsTimedAcquisitions() {
+        Probed values{};
+        {
+            auto held = values.lock();
+            std::thread{[&values]() { (void)values.access_for(std::chrono::milliseconds{1}); }}.join();
+            ProbeLock::waitForFailedAttempt(); //Consumes the failed attempt of the access which timed out.
+        }
+        std::thread waiter;
+        {
+            auto held = values.lock();
+            waiter = std::thread{[&values]() { (void)values.access_for(std::chrono::minutes{1}); }};
+            ProbeLock::waitForFailedAttempt();
+        }
+        waiter.join();
+        const auto& stats = values.statistics();
+        return stats.acquisitions == 3 && stats.contendedAcquisitions == 1 && stats.waitTime.count() == 1;
+    }
+
+    //The widest comma separated list an object has been part of is recorded.
+    bool recordsListWidth() {
+        Probed first{};
+        Probed second{};
+        Probed third{};
+        (first, second) ->* (~first).size();
+        (first, second, third) ->* (~first).size();
+        return first.statistics().maxListWidth == 3 && second.statistics().maxListWidth == 3 && third.statistics().maxListWidth == 3;
+    }
+
+    //dumpStatistics reports the registered objects, the most contended first, and forgets an object once it is destroyed.
+    bool dumpsRegisteredObjects() {
+        std::ostringstream out;
+        {
+            Probed quiet{};
+            Probed busy{};
+            quiet.registerAs("quiet");
+            busy.registerAs("busy");
+            std::thread waiter;
+            {
+                auto held = busy.lock();
+                waiter = std::thread{[&busy]() { busy->push_back(1); }};
+                ProbeLock::waitForFailedAttempt();
+            }
+            waiter.join();
+            thread_safe::dumpStatistics(out);
+        }
+        std::string dumped = out.str();
+        std::size_t busyAt = dumped.find("busy\t");
+        std::size_t quietAt = dumped.find("quiet\t");
+        std::ostringstream after;
+        thread_safe::dumpStatistics(after);
+        return busyAt != std::string::npos && quietAt != std::string::npos && busyAt < quietAt && dumped.find("contended: 1") != std::string::npos && after.str().empty();
+    }
+
+}
+
+int main() {
+    std::pair<std::string_view, std::function<bool()>> tests[] = {
+        {"counts_acquisitions", countsAcquisitions},
+        {"counts_contended_acquisitions", countsContendedAcquisitions},
+        {"counts_timed_acquisitions", countsTimedAcquisitions},
+        {"records_list_width", recordsListWidth},
+        {"dumps_registered_objects", dumpsRegisteredObjects},
+    };
+
+    int failed = 0;
+    for (auto& [name, test] : tests) {
+        bool ok = test();
+        std::cout << (ok ? "ok     " : "FAILED ") << name << std::endl;
+        failed += ok ? 0 : 1;
+    }
+    return failed;
+}